@@ -0,0 +1,521 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+#include <err.h>
+
+#include "cache.h"
+#include "jbod.h"
+#include "mdadm.h"
+#include "net.h"
+#include "stats.h"
+#include "util.h"
+
+#define BENCH_ARGUMENTS "ho:f:e:i:l:k:a:t:H:x:z:c:p:n:W:r:b"
+#define USAGE                                                                     \
+  "USAGE: bench [-h] [-o results] [-f format] [-e backend] [-i image]\n"           \
+  "             [-l layout] [-k chunk_blocks] [-a pattern] [-t theta]\n"           \
+  "             [-H hot_pct:ops_pct] [-x read_pct] [-z sizes] [-c cache_sizes]\n"  \
+  "             [-p policy] [-n ops] [-W warmup_ops] [-r readahead] [-b]\n"        \
+  "\n"                                                                            \
+  "where:\n"                                                                      \
+  "    -h - help mode (display this message)\n"                                   \
+  "    -o - also write the results to this file\n"                                \
+  "    -f - format of the results file: csv (default, or from a .json name), json\n" \
+  "    -e - where the JBOD is: local (default), image, tcp (jbod_server)\n"        \
+  "    -i - image file for the image backend (default jbod.img)\n"                \
+  "    -l - array layout: linear (default), raid0, raid10\n"                      \
+  "    -k - chunk size in blocks for raid0 and raid10 (default 16)\n"             \
+  "    -a - access pattern: seq, uniform (default), zipf, hotset\n"               \
+  "    -t - skew of the zipf pattern (default 0.99)\n"                            \
+  "    -H - hotset pattern: ops_pct%% of the I/Os go to hot_pct%% of the blocks\n"  \
+  "         (default 10:90)\n"                                                    \
+  "    -x - percentage of the I/Os that are reads (default 70)\n"                 \
+  "    -z - I/O sizes in bytes, with optional weights, e.g. 256:3,1024:1\n"        \
+  "         (default 1024)\n"                                                     \
+  "    -c - cache sizes in blocks to run at, 0 for none (default 0,64,256,1024)\n" \
+  "    -p - cache eviction policy: MRU (default), LRU, CLOCK, 2Q, ARC\n"           \
+  "    -n - timed I/Os per cache size (default 20000)\n"                          \
+  "    -W - I/Os run before timing starts, to warm the cache (default 2000)\n"    \
+  "    -r - most blocks to read ahead of sequential reads (default 0, off)\n"      \
+  "    -b - write-back mode (writes stay in the cache until evicted)\n"           \
+  "\n"                                                                            \
+
+typedef enum {
+  PATTERN_SEQ,
+  PATTERN_UNIFORM,
+  PATTERN_ZIPF,
+  PATTERN_HOTSET,
+  NUM_PATTERNS,
+} pattern_t;
+
+static const char *pattern_names[NUM_PATTERNS] = {"seq", "uniform", "zipf", "hotset"};
+
+typedef struct {
+  uint32_t addr;
+  uint16_t len;
+  bool write;
+} bench_op_t;
+
+#define MAX_SIZES 16
+#define MAX_CACHE_SIZES 16
+
+typedef struct {
+  pattern_t pattern;
+  double theta;
+  int hot_pct, hot_ops_pct;
+  int read_pct;
+  int num_sizes;
+  uint32_t sizes[MAX_SIZES];
+  uint32_t weights[MAX_SIZES];
+  uint32_t array_size;
+} workload_t;
+
+//latencies go into the histogram stats keeps for the mdadm calls, plus the largest seen, which a percentile is
+//capped at so it never reads past the slowest operation
+typedef struct {
+  stats_latency_t lat;
+  uint64_t max;
+} histogram_t;
+
+static void hist_record(histogram_t *h, uint64_t ns){
+  stats_record(&h->lat, ns);
+  if (ns > h->max)
+    h->max = ns;
+}
+
+static uint64_t hist_percentile(const histogram_t *h, double pct){
+  uint64_t v = stats_percentile(&h->lat, pct);
+  return v < h->max ? v : h->max;
+}
+
+//parses "size[:weight],..." into the workload's size distribution
+static bool parse_sizes(const char *spec, workload_t *w){
+  char *copy = strdup(spec), *save = NULL;
+  w->num_sizes = 0;
+  for (char *tok = strtok_r(copy, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+    char *colon = strchr(tok, ':');
+    int size = atoi(tok), weight = colon != NULL ? atoi(colon + 1) : 1;
+    if (w->num_sizes == MAX_SIZES || size < 1 || size > MDADM_MAX_IO_SIZE || weight < 1) {
+      free(copy);
+      return false;
+    }
+    w->sizes[w->num_sizes] = size;
+    w->weights[w->num_sizes++] = weight;
+  }
+  free(copy);
+  return w->num_sizes > 0;
+}
+
+static int parse_cache_sizes(const char *spec, int *sizes){
+  char *copy = strdup(spec), *save = NULL;
+  int n = 0;
+  for (char *tok = strtok_r(copy, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+    if (n == MAX_CACHE_SIZES || atoi(tok) < 0) {
+      n = -1;
+      break;
+    }
+    sizes[n++] = atoi(tok);
+  }
+  free(copy);
+  return n;
+}
+
+static uint32_t pick_size(const workload_t *w){
+  uint32_t total = 0;
+  for (int i = 0; i < w->num_sizes; ++i)
+    total += w->weights[i];
+  uint32_t r = get_rand(0, total - 1);
+  for (int i = 0; i < w->num_sizes; ++i) {
+    if (r < w->weights[i])
+      return w->sizes[i];
+    r -= w->weights[i];
+  }
+  return w->sizes[w->num_sizes - 1];
+}
+
+//a uniform double in [0, 1)
+static double rand_unit(void){
+  return get_rand(0, UINT32_MAX - 1) / (double)UINT32_MAX;
+}
+
+//the skewed patterns pick a block by rank, hottest first, and spread the ranks over the array with a multiplicative
+//hash so the hot blocks are not all on the first disk. the number of blocks is a power of two, which any odd
+//multiplier permutes
+static uint32_t rank_to_block(uint32_t rank, uint32_t num_blocks){
+  return (rank * 2654435761u) & (num_blocks - 1);
+}
+
+//generates n operations, all drawn from get_rand up front so the timed loop only runs mdadm
+static bench_op_t *make_ops(const workload_t *w, long n){
+  bench_op_t *ops = malloc(n * sizeof(*ops));
+  uint32_t num_blocks = w->array_size / JBOD_BLOCK_SIZE;
+  double *cdf = NULL;
+  uint32_t next = 0;
+
+  if (ops == NULL)
+    return NULL;
+  if (w->pattern == PATTERN_ZIPF) {
+    cdf = malloc(num_blocks * sizeof(*cdf));
+    double sum = 0;
+    for (uint32_t k = 0; k < num_blocks; ++k)
+      cdf[k] = sum += 1 / pow(k + 1, w->theta);
+    for (uint32_t k = 0; k < num_blocks; ++k)
+      cdf[k] /= sum;
+  }
+
+  for (long i = 0; i < n; ++i) {
+    uint32_t len = pick_size(w), block, addr;
+    switch (w->pattern) {
+      case PATTERN_SEQ:
+        if (next + len > w->array_size)
+          next = 0;
+        addr = next;
+        next += len;
+        break;
+      case PATTERN_ZIPF: {
+        double u = rand_unit();
+        uint32_t lo = 0, hi = num_blocks - 1;
+        while (lo < hi) {
+          uint32_t mid = (lo + hi) / 2;
+          if (cdf[mid] < u)
+            lo = mid + 1;
+          else
+            hi = mid;
+        }
+        block = rank_to_block(lo, num_blocks);
+        addr = block * JBOD_BLOCK_SIZE;
+        break;
+      }
+      case PATTERN_HOTSET: {
+        uint32_t hot = num_blocks * w->hot_pct / 100;
+        if (hot < 1)
+          hot = 1;
+        if ((int)get_rand(0, 99) < w->hot_ops_pct || hot == num_blocks)
+          block = rank_to_block(get_rand(0, hot - 1), num_blocks);
+        else
+          block = rank_to_block(get_rand(hot, num_blocks - 1), num_blocks);
+        addr = block * JBOD_BLOCK_SIZE;
+        break;
+      }
+      default:
+        addr = get_rand(0, w->array_size - len);
+        break;
+    }
+    if (addr + len > w->array_size)
+      addr = w->array_size - len;
+    ops[i] = (bench_op_t){addr, len, (int)get_rand(0, 99) >= w->read_pct};
+  }
+  free(cdf);
+  return ops;
+}
+
+static uint64_t now_ns(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+typedef struct {
+  int cache_size;
+  long ops, reads, writes, bytes;
+  double seconds;
+  histogram_t all, read, write;
+  long requests;
+  long cost;
+  int hits, queries;
+} result_t;
+
+static void run_op(const bench_op_t *op, uint8_t *buf){
+  int rc = op->write ? mdadm_write(op->addr, op->len, buf) : mdadm_read(op->addr, op->len, buf);
+  if (rc != op->len)
+    errx(1, "%s of %u bytes at %u failed (%d).", op->write ? "Write" : "Read", op->len, op->addr, rc);
+}
+
+static void run(const bench_op_t *ops, long warmup, long n, int cache_size, cache_policy_t policy, int write_back,
+                int readahead, result_t *r){
+  uint8_t buf[MDADM_MAX_IO_SIZE];
+  memset(buf, 0xa5, sizeof(buf));
+  memset(r, 0, sizeof(*r));
+  r->cache_size = cache_size;
+
+  if (cache_size > 0 && cache_create_with_policy(cache_size, policy) != 1)
+    errx(1, "Failed to create cache of %d entries.", cache_size);
+  if (mdadm_mount() != 1 || mdadm_write_permission() != 1)
+    errx(1, "Failed to mount the array.");
+  mdadm_set_write_back(write_back);
+  mdadm_set_readahead(readahead);
+
+  for (long i = 0; i < warmup; ++i)
+    run_op(&ops[i], buf);
+
+  //everything the JBOD did during the warmup is left out
+  int hits0 = 0, queries0 = 0;
+  if (cache_size > 0)
+    cache_get_hits(&hits0, &queries0);
+  long requests0 = jbod_client_requests(), cost0 = jbod_client_cost();
+
+  uint64_t start = now_ns();
+  for (long i = warmup; i < warmup + n; ++i) {
+    uint64_t t0 = now_ns();
+    run_op(&ops[i], buf);
+    uint64_t ns = now_ns() - t0;
+    hist_record(&r->all, ns);
+    hist_record(ops[i].write ? &r->write : &r->read, ns);
+    r->bytes += ops[i].len;
+  }
+  //write-back leaves the writes in the cache, and they have not been paid for until they reach the JBOD
+  if (mdadm_flush() != 1)
+    errx(1, "Failed to flush the array.");
+  r->seconds = (now_ns() - start) / 1e9;
+
+  r->ops = n;
+  r->reads = r->read.lat.count;
+  r->writes = r->write.lat.count;
+  r->requests = jbod_client_requests() - requests0;
+  r->cost = cost0 == -1 ? -1 : jbod_client_cost() - cost0;
+  if (cache_size > 0) {
+    cache_get_hits(&r->hits, &r->queries);
+    r->hits -= hits0;
+    r->queries -= queries0;
+  }
+
+  mdadm_set_write_back(0);
+  mdadm_revoke_write_permission();
+  mdadm_unmount();
+  if (cache_size > 0)
+    cache_destroy();
+}
+
+static double us(uint64_t ns){
+  return ns / 1000.0;
+}
+
+static double hit_rate(const result_t *r){
+  return r->queries > 0 ? 100.0 * r->hits / r->queries : 0;
+}
+
+static void print_table_header(void){
+  printf("%7s %10s %9s %9s %9s %9s %9s %9s %11s %10s %9s\n", "cache", "IOPS", "MB/s", "mean us", "p50 us", "p99 us",
+         "p99.9 us", "max us", "trips/IO", "cost/IO", "hit rate");
+}
+
+static void print_table_row(const result_t *r){
+  printf("%7d %10.0f %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f %11.2f %10.1f %8.1f%%\n", r->cache_size, r->ops / r->seconds,
+         r->bytes / r->seconds / 1e6, us(r->all.lat.total_ns) / r->ops, us(hist_percentile(&r->all, 50)),
+         us(hist_percentile(&r->all, 99)), us(hist_percentile(&r->all, 99.9)), us(r->all.max),
+         (double)r->requests / r->ops, r->cost == -1 ? NAN : (double)r->cost / r->ops, hit_rate(r));
+}
+
+//the columns of a results row, in order; the run's settings come first, then what was measured
+static const char *fields[] = {
+    "backend", "layout", "pattern", "read_pct", "sizes", "policy", "cache_size", "write_back", "readahead", "ops",
+    "reads", "writes", "seconds", "iops", "mb_per_s", "mean_us", "p50_us", "p99_us", "p999_us", "max_us",
+    "read_p50_us", "read_p99_us", "read_p999_us", "write_p50_us", "write_p99_us", "write_p999_us", "round_trips",
+    "round_trips_per_io", "jbod_cost", "cost_per_io", "hit_rate",
+};
+#define NUM_FIELDS (int)(sizeof(fields) / sizeof(fields[0]))
+
+//writes one results row as CSV or as a JSON object. strings are quoted in both
+static void write_row(FILE *f, bool json, const char *settings[], const result_t *r, const char *policy,
+                      int write_back, int readahead){
+  char values[NUM_FIELDS][64];
+  int v = 0;
+  for (; settings[v] != NULL; ++v)
+    snprintf(values[v], sizeof(values[v]), "\"%s\"", settings[v]);
+  snprintf(values[v++], sizeof(values[0]), "\"%s\"", r->cache_size > 0 ? policy : "none");
+  snprintf(values[v++], sizeof(values[0]), "%d", r->cache_size);
+  snprintf(values[v++], sizeof(values[0]), "%d", write_back);
+  snprintf(values[v++], sizeof(values[0]), "%d", readahead);
+  snprintf(values[v++], sizeof(values[0]), "%ld", r->ops);
+  snprintf(values[v++], sizeof(values[0]), "%ld", r->reads);
+  snprintf(values[v++], sizeof(values[0]), "%ld", r->writes);
+  snprintf(values[v++], sizeof(values[0]), "%.6f", r->seconds);
+  snprintf(values[v++], sizeof(values[0]), "%.1f", r->ops / r->seconds);
+  snprintf(values[v++], sizeof(values[0]), "%.3f", r->bytes / r->seconds / 1e6);
+  snprintf(values[v++], sizeof(values[0]), "%.3f", us(r->all.lat.total_ns) / r->ops);
+  const histogram_t *hists[] = {&r->all, &r->read, &r->write};
+  for (int h = 0; h < 3; ++h) {
+    snprintf(values[v++], sizeof(values[0]), "%.3f", us(hist_percentile(hists[h], 50)));
+    snprintf(values[v++], sizeof(values[0]), "%.3f", us(hist_percentile(hists[h], 99)));
+    snprintf(values[v++], sizeof(values[0]), "%.3f", us(hist_percentile(hists[h], 99.9)));
+    if (h == 0)
+      snprintf(values[v++], sizeof(values[0]), "%.3f", us(r->all.max));
+  }
+  snprintf(values[v++], sizeof(values[0]), "%ld", r->requests);
+  snprintf(values[v++], sizeof(values[0]), "%.3f", (double)r->requests / r->ops);
+  snprintf(values[v++], sizeof(values[0]), "%ld", r->cost);
+  snprintf(values[v++], sizeof(values[0]), "%.1f", r->cost == -1 ? -1.0 : (double)r->cost / r->ops);
+  snprintf(values[v++], sizeof(values[0]), "%.2f", hit_rate(r));
+
+  for (int i = 0; i < NUM_FIELDS; ++i) {
+    if (json)
+      fprintf(f, "%s\"%s\": %s", i == 0 ? "  {" : ", ", fields[i], values[i]);
+    else
+      fprintf(f, "%s%s", i == 0 ? "" : ",", values[i]);
+  }
+  fprintf(f, json ? "}" : "\n");
+}
+
+int main(int argc, char *argv[])
+{
+  int ch;
+  const char *output = NULL, *format = NULL, *sizes_spec = "1024", *cache_spec = "0,64,256,1024";
+  workload_t w = {.pattern = PATTERN_UNIFORM, .theta = 0.99, .hot_pct = 10, .hot_ops_pct = 90, .read_pct = 70};
+  mdadm_layout_t layout = MDADM_LAYOUT_LINEAR;
+  int chunk_blocks = MDADM_DEFAULT_CHUNK_BLOCKS;
+  cache_policy_t policy = CACHE_POLICY_MRU;
+  long num_ops = 20000, warmup = 2000;
+  int readahead = 0, write_back = 0;
+  int cache_sizes[MAX_CACHE_SIZES], num_cache_sizes;
+  char read_pct[16];
+
+  jbod_client_set_backend(JBOD_BACKEND_LOCAL);
+  while ((ch = getopt(argc, argv, BENCH_ARGUMENTS)) != -1) {
+    switch (ch) {
+      case 'h':
+        fprintf(stderr, USAGE);
+        return 0;
+      case 'o':
+        output = optarg;
+        break;
+      case 'f':
+        if (strcasecmp(optarg, "csv") != 0 && strcasecmp(optarg, "json") != 0)
+          errx(1, "Unknown results format %s.", optarg);
+        format = optarg;
+        break;
+      case 'e':
+        if (jbod_backend_from_name(optarg) == -1)
+          errx(1, "Unknown backend %s.", optarg);
+        jbod_client_set_backend(jbod_backend_from_name(optarg));
+        break;
+      case 'i':
+        jbod_client_set_image(optarg);
+        break;
+      case 'l':
+        if (mdadm_layout_from_name(optarg) == -1)
+          errx(1, "Unknown layout %s.", optarg);
+        layout = mdadm_layout_from_name(optarg);
+        break;
+      case 'k':
+        chunk_blocks = atoi(optarg);
+        break;
+      case 'a':
+        w.pattern = NUM_PATTERNS;
+        for (int p = 0; p < NUM_PATTERNS; ++p)
+          if (strcasecmp(optarg, pattern_names[p]) == 0)
+            w.pattern = p;
+        if (w.pattern == NUM_PATTERNS)
+          errx(1, "Unknown access pattern %s.", optarg);
+        break;
+      case 't':
+        w.theta = atof(optarg);
+        if (w.theta <= 0)
+          errx(1, "Zipf skew must be greater than 0.");
+        break;
+      case 'H':
+        if (sscanf(optarg, "%d:%d", &w.hot_pct, &w.hot_ops_pct) != 2 || w.hot_pct < 1 || w.hot_pct > 100 ||
+            w.hot_ops_pct < 0 || w.hot_ops_pct > 100)
+          errx(1, "Hot set must be hot_pct:ops_pct, both percentages.");
+        break;
+      case 'x':
+        w.read_pct = atoi(optarg);
+        if (w.read_pct < 0 || w.read_pct > 100)
+          errx(1, "Read percentage must be between 0 and 100.");
+        break;
+      case 'z':
+        sizes_spec = optarg;
+        break;
+      case 'c':
+        cache_spec = optarg;
+        break;
+      case 'p':
+        if (cache_policy_from_name(optarg) == -1)
+          errx(1, "Unknown cache policy %s.", optarg);
+        policy = cache_policy_from_name(optarg);
+        break;
+      case 'n':
+        num_ops = atol(optarg);
+        if (num_ops < 1)
+          errx(1, "Number of I/Os must be at least 1.");
+        break;
+      case 'W':
+        warmup = atol(optarg);
+        if (warmup < 0)
+          errx(1, "Number of warmup I/Os must not be negative.");
+        break;
+      case 'r':
+        readahead = atoi(optarg);
+        if (readahead < 0 || readahead > JBOD_MAX_BATCH)
+          errx(1, "Readahead must be between 0 and %d blocks.", JBOD_MAX_BATCH);
+        break;
+      case 'b':
+        write_back = 1;
+        break;
+      default:
+        fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+        return -1;
+    }
+  }
+
+  if (!parse_sizes(sizes_spec, &w))
+    errx(1, "Sizes must be size[:weight],... with sizes between 1 and %d bytes.", MDADM_MAX_IO_SIZE);
+  num_cache_sizes = parse_cache_sizes(cache_spec, cache_sizes);
+  if (num_cache_sizes < 1)
+    errx(1, "Cache sizes must be up to %d block counts separated by commas.", MAX_CACHE_SIZES);
+  if (mdadm_set_layout(layout, chunk_blocks) != 1)
+    errx(1, "Chunk size must be a power of two of at most %d blocks.", JBOD_NUM_BLOCKS_PER_DISK);
+  w.array_size = (layout == MDADM_LAYOUT_RAID10 ? JBOD_NUM_DISKS / 2 : JBOD_NUM_DISKS) * JBOD_DISK_SIZE;
+
+  bool json = format != NULL ? strcasecmp(format, "json") == 0
+                             : output != NULL && strlen(output) > 5 && strcmp(output + strlen(output) - 5, ".json") == 0;
+  FILE *f = NULL;
+  if (output != NULL && (f = fopen(output, "w")) == NULL)
+    err(1, "Failed to open %s", output);
+
+  //every cache size runs the same I/Os
+  bench_op_t *ops = make_ops(&w, warmup + num_ops);
+  if (ops == NULL)
+    errx(1, "Failed to generate %ld I/Os.", warmup + num_ops);
+
+  if (!jbod_connect(JBOD_SERVER, JBOD_PORT))
+    errx(1, "Failed to connect to the JBOD.");
+
+  snprintf(read_pct, sizeof(read_pct), "%d", w.read_pct);
+  const char *settings[] = {jbod_backend_name(jbod_client_backend()), mdadm_layout_name(layout),
+                            pattern_names[w.pattern], read_pct, sizes_spec, NULL};
+  printf("%s backend, %s layout, %s pattern, %d%% reads, sizes %s, %ld I/Os after %ld warmup\n", settings[0],
+         settings[1], settings[2], w.read_pct, sizes_spec, num_ops, warmup);
+  print_table_header();
+  if (f != NULL && json)
+    fprintf(f, "[\n");
+  else if (f != NULL)
+    for (int i = 0; i < NUM_FIELDS; ++i)
+      fprintf(f, "%s%s", i == 0 ? "" : ",", fields[i]);
+  if (f != NULL && !json)
+    fprintf(f, "\n");
+
+  for (int c = 0; c < num_cache_sizes; ++c) {
+    result_t r;
+    run(ops, warmup, num_ops, cache_sizes[c], policy, write_back, readahead, &r);
+    print_table_row(&r);
+    if (f != NULL) {
+      write_row(f, json, settings, &r, cache_policy_name(policy), write_back, readahead);
+      if (json)
+        fprintf(f, c + 1 < num_cache_sizes ? ",\n" : "\n");
+    }
+  }
+  if (f != NULL && json)
+    fprintf(f, "]\n");
+  if (f != NULL)
+    fclose(f);
+
+  jbod_disconnect();
+  free(ops);
+  return 0;
+}
@@ -1,69 +1,863 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <stdio.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include "cache.h"
 #include "jbod.h"
+#include "stats.h"
 
-//Uncomment the below code before implementing cache functioncs.
-static cache_entry_t *cache = NULL;
-static int cache_size = 0;
-static int clock = 0;
-static int num_queries = 0;
-static int num_hits = 0;
-
-//helper function to search cache for entry
-//returns index of cache entry with disk_num and block_num, otherwise returns -1 if not found
-int cache_search(int disk_num, int block_num){
-  for(int i = 0; i < cache_size; i++){
-    clock++;
-    if(cache[i].valid == false){
+#define NUM_KEYS (JBOD_NUM_DISKS * JBOD_NUM_BLOCKS_PER_DISK)
+
+//every policy keeps its entries on at most two resident lists and two ghost lists. MRU, LRU and CLOCK only use
+//LIST_RECENT. 2Q uses LIST_RECENT as A1in, LIST_FREQUENT as Am and LIST_GHOST_RECENT as A1out. ARC uses all four as
+//T1, T2, B1 and B2. each list runs from its least recently used head to its most recently used tail
+enum {
+  LIST_RECENT,
+  LIST_FREQUENT,
+  LIST_GHOST_RECENT,
+  LIST_GHOST_FREQUENT,
+  NUM_LISTS,
+  LIST_NONE = 0xff,
+};
+
+typedef struct {
+  int head;
+  int tail;
+  int len;
+} cache_list_t;
+
+//the cache is split into shards, each caching its own share of the blocks (key % num_shards) with its own entries,
+//lists and policy state behind its own lock, so threads working on different shards never wait for each other.
+//within a shard the entries are laid out as a structure of arrays so that probing and reordering entries only ever
+//touches small, densely packed metadata. entry i is described by tags[i], ref[i], dirty[i] and the list links below,
+//and its payload is the i'th JBOD_BLOCK_SIZE chunk of the slab. entries are only ever referred to by index, so
+//payloads never move.
+//
+//list nodes: nodes [0, size) are the resident entries, and nodes [size, 2 * size) are ghost nodes, which remember only
+//the key of a recently evicted block (ghost_tags) for the policies that adapt to them. where[node] is the list a node
+//is currently on, or LIST_NONE if it is free
+//what a lock-free reader needs to find and copy an entry, published as a single pointer so a reader never pairs an
+//index with arrays of another size. resizing retires the old view, chaining it to the new one, instead of freeing its
+//arrays, since a reader may still be copying from them; cache_destroy frees the whole chain
+typedef struct shard_view {
+  int size;
+  uint8_t *slab;
+  uint8_t *ref;
+  struct shard_view *retired;
+} shard_view_t;
+
+//a shard is also a seqlock: seq is odd while a writer (holding lock) changes which block an entry holds or what it
+//contains, and readers that copy an entry without the lock check that seq was even and unchanged throughout
+typedef struct {
+  unsigned seq;
+  shard_view_t *view;
+  pthread_mutex_t lock;
+  int id;
+  int size;
+  uint16_t *tags;
+  uint8_t *ref;
+  uint8_t *dirty;
+  uint8_t *slab;
+  int16_t *prev;
+  int16_t *next;
+  uint8_t *where;
+  uint16_t *ghost_tags;
+  cache_list_t lists[NUM_LISTS];
+  int free_head;
+  int ghost_free_head;
+
+  //2Q and ARC remember whether the block being inserted was found in a ghost list, so admit knows where it belongs
+  int pending_list;
+  bool pending_from_ghost_frequent;
+
+  //ARC's adaptive target size for LIST_RECENT
+  int arc_p;
+
+  //what the policy's last eviction took off the lists, so a victim that cannot be written back can be put back as it
+  //was: the resident list it came from and the entry before it there, and the ghosts dropped to make room for its own
+  int victim_list;
+  int victim_prev;
+  int num_dropped;
+  uint8_t dropped_list[2];
+  uint16_t dropped_key[2];
+
+  //the ghost the miss hook took for the block being admitted: the ghost list it was on (LIST_NONE if there was none)
+  //and the key of the ghost before it there (-1 if it was the head), so an admit that fails can put it back
+  int taken_list;
+  uint16_t taken_key;
+  int taken_prev_key;
+
+  struct cache_stats *stats;
+} __attribute__((aligned(CACHE_LINE_SIZE))) cache_shard_t;
+
+static cache_shard_t *shards = NULL;
+static int num_shards = 0;
+
+//each shard's counters, updated under its lock. they outlive the cache so the hit rate can still be printed after
+//cache_destroy, and are reset by the next cache_create
+typedef struct cache_stats {
+  int num_inserts;
+  int num_evictions;
+  int num_ghost_hits;
+  int num_writebacks;
+  int num_prefetches;
+  int num_prefetches_wasted;
+} __attribute__((aligned(CACHE_LINE_SIZE))) cache_stats_t;
+
+static cache_stats_t stats[CACHE_MAX_SHARDS];
+static int num_stats = 0;
+
+//lookups are counted in stats by the thread making them (STATS_CACHE_HITS, _MISSES and _PREFETCH_HITS). these are
+//what the counters stood at when the cache was created, which cache_get_hits and cache_print_hit_rate count from
+static uint64_t hits_at_create, misses_at_create, prefetch_hits_at_create;
+
+//a lock-free read retries this many times while writers keep changing its shard before it takes the lock instead
+#define CACHE_SEQ_RETRIES 4
+
+//direct-mapped indexes from a packed key to the resident entry / ghost node of its shard holding it, or -1 if there
+//is none. there are only NUM_KEYS possible keys so a full table replaces hashing entirely. a key's slots belong to
+//its shard and are only touched under that shard's lock
+static int16_t cache_index[NUM_KEYS];
+static int16_t ghost_index[NUM_KEYS];
+
+//bumped whenever a key is inserted, updated or written, so a block read from the JBOD can be checked for having been
+//overtaken by a newer copy while it was on its way (see cache_fill)
+static uint32_t versions[NUM_KEYS];
+
+//set while a key's block is cached because it was prefetched (see cache_prefetch) and has not been looked up since.
+//the first lookup to hit it clears it and counts a prefetch hit; dropping it any other way (eviction, an update,
+//cache_destroy) counts the prefetch as wasted. lookups clear it without the shard lock, so it is only ever swapped
+static uint8_t prefetched[NUM_KEYS];
+
+//helper function to bump key's version. versions are read without the shard lock (cache_version), so the update
+//has to be atomic even though it is made with the lock held
+static void bump_version(uint16_t key){
+  __atomic_fetch_add(&versions[key], 1, __ATOMIC_RELEASE);
+}
+
+//called to write a dirty block back to the JBOD before it leaves the cache
+static cache_writeback_t writeback = NULL;
+
+//policy hooks. miss is called before a new block is admitted, evict must pick a resident entry, unlink it and return
+//its index, admit links a freshly filled entry, and hit is called whenever a resident entry is read or updated.
+//policies whose hit only sets the entry's reference bit set lockless_hit, and cache_lookup then does that itself
+//without taking the shard's lock
+typedef struct {
+  void (*miss)(cache_shard_t *s, uint16_t key);
+  int (*evict)(cache_shard_t *s);
+  void (*admit)(cache_shard_t *s, int i);
+  void (*hit)(cache_shard_t *s, int i);
+  bool lockless_hit;
+} cache_policy_ops_t;
+
+static const cache_policy_ops_t *policy = NULL;
+static cache_policy_t policy_id = CACHE_POLICY_MRU;
+
+static const char *policy_names[CACHE_NUM_POLICIES] = {"MRU", "LRU", "CLOCK", "2Q", "ARC"};
+
+//helper function to check that disk_num and block_num name a real block, so they can safely be packed into a key
+static bool cache_key_valid(int disk_num, int block_num){
+  return disk_num >= 0 && disk_num < JBOD_NUM_DISKS && block_num >= 0 && block_num < JBOD_NUM_BLOCKS_PER_DISK;
+}
+
+//helper function to pack disk_num and block_num into the 12 bit key stored in tags and used to index cache_index
+static uint16_t cache_key(int disk_num, int block_num){
+  return (uint16_t)((disk_num << 8) | block_num);
+}
+
+//helper function to find the shard that caches key. consecutive blocks go to different shards, so a scan spreads
+//over all of them
+static cache_shard_t *shard_of(uint16_t key){
+  return &shards[key % num_shards];
+}
+
+//helper function to get the payload of entry i in the slab
+static uint8_t *cache_block(cache_shard_t *s, int i){
+  return &s->slab[(size_t)i * JBOD_BLOCK_SIZE];
+}
+
+//helper functions to copy a payload into / out of the slab a word at a time with atomic accesses, since lock-free
+//readers may be copying it at the same time as a writer. a torn copy is caught by the seqlock
+static void block_store(uint8_t *dst, const uint8_t *src){
+  uint64_t *d = (uint64_t *)dst;
+  for(int w = 0; w < JBOD_BLOCK_SIZE / 8; w++){
+    uint64_t v;
+    memcpy(&v, &src[w * 8], 8);
+    __atomic_store_n(&d[w], v, __ATOMIC_RELAXED);
+  }
+}
+
+static void block_load(uint8_t *dst, const uint8_t *src){
+  const uint64_t *s = (const uint64_t *)src;
+  for(int w = 0; w < JBOD_BLOCK_SIZE / 8; w++){
+    uint64_t v = __atomic_load_n(&s[w], __ATOMIC_RELAXED);
+    memcpy(&dst[w * 8], &v, 8);
+  }
+}
+
+//helper functions to read and set entry i's reference bit, which lock-free readers set too
+static uint8_t ref_get(cache_shard_t *s, int i){
+  return __atomic_load_n(&s->ref[i], __ATOMIC_RELAXED);
+}
+
+static void ref_set(cache_shard_t *s, int i, uint8_t v){
+  __atomic_store_n(&s->ref[i], v, __ATOMIC_RELAXED);
+}
+
+//helper function to point key's index slot at entry i (or -1), which lock-free readers may be looking at
+static void index_set(uint16_t key, int i){
+  __atomic_store_n(&cache_index[key], (int16_t)i, __ATOMIC_RELAXED);
+}
+
+//helper functions to open and close a write section of shard s's seqlock, with its lock held
+static void seq_write_begin(cache_shard_t *s){
+  __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void seq_write_end(cache_shard_t *s){
+  __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+}
+
+//helper function to copy key's block out of shard s without its lock, setting the entry's reference bit if touch is
+//set. returns 1 if the block is cached, -1 if it is not, and 0 if writers kept changing the shard and the caller has
+//to take the lock after all
+static int lockless_copy(cache_shard_t *s, uint16_t key, uint8_t *buf, bool touch){
+  for(int tries = 0; tries < CACHE_SEQ_RETRIES; tries++){
+    unsigned seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+    if(seq & 1){
       continue;
     }
-    if(cache[i].disk_num == disk_num && cache[i].block_num == block_num){
-      return i;
+    shard_view_t *v = __atomic_load_n(&s->view, __ATOMIC_ACQUIRE);
+    int i = __atomic_load_n(&cache_index[key], __ATOMIC_RELAXED);
+    if(i >= v->size){
+      continue;
+    }
+    if(i != -1){
+      block_load(buf, &v->slab[(size_t)i * JBOD_BLOCK_SIZE]);
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if(__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq){
+      continue;
+    }
+    //the entry may have been reused since, which only costs some other block a second chance
+    if(i != -1 && touch){
+      __atomic_store_n(&v->ref[i], 1, __ATOMIC_RELAXED);
     }
+    return i == -1 ? -1 : 1;
   }
-  return -1;
+  return 0;
+}
+
+//helper function to unlink node from whatever list it is on
+static void list_unlink(cache_shard_t *s, int node){
+  cache_list_t *l = &s->lists[s->where[node]];
+  if(s->prev[node] != -1){
+    s->next[s->prev[node]] = s->next[node];
+  }
+  else{
+    l->head = s->next[node];
+  }
+  if(s->next[node] != -1){
+    s->prev[s->next[node]] = s->prev[node];
+  }
+  else{
+    l->tail = s->prev[node];
+  }
+  l->len--;
+  s->prev[node] = -1;
+  s->next[node] = -1;
+  s->where[node] = LIST_NONE;
+}
+
+//helper function to append node to the most recently used end of list id
+static void list_push_tail(cache_shard_t *s, int id, int node){
+  cache_list_t *l = &s->lists[id];
+  s->prev[node] = l->tail;
+  s->next[node] = -1;
+  if(l->tail != -1){
+    s->next[l->tail] = node;
+  }
+  else{
+    l->head = node;
+  }
+  l->tail = node;
+  l->len++;
+  s->where[node] = id;
+}
+
+//helper function to put node back into list id right after node prev, or at its least recently used head if prev is -1
+static void list_insert_after(cache_shard_t *s, int id, int prev, int node){
+  cache_list_t *l = &s->lists[id];
+  int next = prev != -1 ? s->next[prev] : l->head;
+  s->prev[node] = prev;
+  s->next[node] = next;
+  if(prev != -1){
+    s->next[prev] = node;
+  }
+  else{
+    l->head = node;
+  }
+  if(next != -1){
+    s->prev[next] = node;
+  }
+  else{
+    l->tail = node;
+  }
+  l->len++;
+  s->where[node] = id;
+}
+
+//helper function to remember where a victim popped off resident list id was, for cache_evict_one to undo
+static void victim_note(cache_shard_t *s, int id, int node){
+  if(id <= LIST_FREQUENT){
+    s->victim_list = id;
+    s->victim_prev = s->prev[node];
+  }
+}
+
+//helper function to move node to the most recently used end of list id, which may be the list it is already on
+static void list_move_tail(cache_shard_t *s, int id, int node){
+  if(s->where[node] == id && s->lists[id].tail == node){
+    return;
+  }
+  list_unlink(s, node);
+  list_push_tail(s, id, node);
+}
+
+//helper function to remove and return the least recently used node of list id
+static int list_pop_head(cache_shard_t *s, int id){
+  int node = s->lists[id].head;
+  victim_note(s, id, node);
+  list_unlink(s, node);
+  return node;
+}
+
+//helper function to remove and return the most recently used node of list id
+static int list_pop_tail(cache_shard_t *s, int id){
+  int node = s->lists[id].tail;
+  victim_note(s, id, node);
+  list_unlink(s, node);
+  return node;
+}
+
+//helper function to drop the least recently used ghost of list id and return its node to the ghost free list
+static void ghost_drop_head(cache_shard_t *s, int id){
+  int node = list_pop_head(s, id);
+  if(s->num_dropped < 2){
+    s->dropped_list[s->num_dropped] = id;
+    s->dropped_key[s->num_dropped] = s->ghost_tags[node - s->size];
+    s->num_dropped++;
+  }
+  ghost_index[s->ghost_tags[node - s->size]] = -1;
+  s->next[node] = s->ghost_free_head;
+  s->ghost_free_head = node;
+}
+
+//helper function to remember the key of evicted entry i on ghost list id
+static void ghost_add(cache_shard_t *s, int id, int i){
+  if(s->ghost_free_head == -1){
+    //the policies keep at most size ghosts, this only guards against running out
+    ghost_drop_head(s, s->lists[LIST_GHOST_RECENT].len > s->lists[LIST_GHOST_FREQUENT].len ? LIST_GHOST_RECENT
+                                                                                            : LIST_GHOST_FREQUENT);
+  }
+  int node = s->ghost_free_head;
+  s->ghost_free_head = s->next[node];
+  s->ghost_tags[node - s->size] = s->tags[i];
+  ghost_index[s->tags[i]] = node;
+  list_push_tail(s, id, node);
+}
+
+//helper function to check whether key is remembered by a ghost list. if so, the ghost is dropped and the list it
+//was on is returned so the policy can admit the block accordingly, otherwise LIST_NONE is returned
+static int ghost_remove(cache_shard_t *s, uint16_t key){
+  int node = ghost_index[key];
+  if(node == -1){
+    return LIST_NONE;
+  }
+  int id = s->where[node];
+  list_unlink(s, node);
+  ghost_index[key] = -1;
+  s->next[node] = s->ghost_free_head;
+  s->ghost_free_head = node;
+  return id;
+}
+
+//helper function to remember key again on ghost list id, right after ghost node prev, or at the least recently used
+//head if prev is -1, which is where ghost_drop_head took it from
+static void ghost_restore(cache_shard_t *s, int id, int prev, uint16_t key){
+  int node = s->ghost_free_head;
+  s->ghost_free_head = s->next[node];
+  s->ghost_tags[node - s->size] = key;
+  ghost_index[key] = node;
+  list_insert_after(s, id, prev, node);
+}
+
+//helper function for the policies' miss hooks: ghost_remove, counting the ghost hit if there was one and noting
+//where the ghost was for ghost_untake
+static int ghost_take(cache_shard_t *s, uint16_t key){
+  int node = ghost_index[key];
+  if(node != -1){
+    int prev = s->prev[node];
+    s->taken_key = key;
+    s->taken_prev_key = prev != -1 ? s->ghost_tags[prev - s->size] : -1;
+  }
+  int id = ghost_remove(s, key);
+  if(id != LIST_NONE){
+    s->stats->num_ghost_hits++;
+  }
+  s->taken_list = id;
+  return id;
+}
+
+//helper function to undo the miss hook's ghost_take for a block that could not be admitted after all, putting the
+//ghost back after the one it followed, or at the head if that one is gone
+static void ghost_untake(cache_shard_t *s){
+  if(s->taken_list == LIST_NONE){
+    return;
+  }
+  int prev = s->taken_prev_key != -1 ? ghost_index[s->taken_prev_key] : -1;
+  if(prev != -1 && s->where[prev] != s->taken_list){
+    prev = -1;
+  }
+  ghost_restore(s, s->taken_list, prev, s->taken_key);
+  s->stats->num_ghost_hits--;
+  s->taken_list = LIST_NONE;
+}
+
+//MRU: evicts the most recently used entry, which suits pure looping scans
+static int mru_evict(cache_shard_t *s){
+  return list_pop_tail(s, LIST_RECENT);
+}
+
+static void recent_admit(cache_shard_t *s, int i){
+  list_push_tail(s, LIST_RECENT, i);
+}
+
+static void recent_hit(cache_shard_t *s, int i){
+  list_move_tail(s, LIST_RECENT, i);
+}
+
+static const cache_policy_ops_t mru_ops = {NULL, mru_evict, recent_admit, recent_hit, false};
+
+//LRU: evicts the least recently used entry
+static int lru_evict(cache_shard_t *s){
+  return list_pop_head(s, LIST_RECENT);
+}
+
+static const cache_policy_ops_t lru_ops = {NULL, lru_evict, recent_admit, recent_hit, false};
+
+//CLOCK: LIST_RECENT is the clock face in insertion order with the hand at its head. a hit only sets the entry's
+//reference bit, so its lookups need no lock at all. the hand gives each referenced entry a second chance, clearing
+//its bit and passing it to the tail, and evicts the first unreferenced entry it reaches
+static int clock_evict(cache_shard_t *s){
+  while(ref_get(s, s->lists[LIST_RECENT].head)){
+    int i = s->lists[LIST_RECENT].head;
+    ref_set(s, i, 0);
+    list_move_tail(s, LIST_RECENT, i);
+  }
+  return list_pop_head(s, LIST_RECENT);
+}
+
+static void clock_admit(cache_shard_t *s, int i){
+  ref_set(s, i, 0);
+  list_push_tail(s, LIST_RECENT, i);
+}
+
+static void clock_hit(cache_shard_t *s, int i){
+  ref_set(s, i, 1);
+}
+
+static const cache_policy_ops_t clock_ops = {NULL, clock_evict, clock_admit, clock_hit, true};
+
+//2Q: new blocks enter the A1in FIFO. blocks evicted from A1in are remembered in A1out, and a block that is missed
+//again while in A1out is admitted to the Am LRU list, which a one-off scan cannot flush
+static int twoq_kin(cache_shard_t *s){
+  return s->size / 4 > 0 ? s->size / 4 : 1;
+}
+
+static int twoq_kout(cache_shard_t *s){
+  return s->size / 2 > 0 ? s->size / 2 : 1;
+}
+
+static void twoq_miss(cache_shard_t *s, uint16_t key){
+  s->pending_list = ghost_take(s, key) == LIST_NONE ? LIST_RECENT : LIST_FREQUENT;
+}
+
+static int twoq_evict(cache_shard_t *s){
+  if(s->lists[LIST_RECENT].len > twoq_kin(s) || s->lists[LIST_FREQUENT].len == 0){
+    int i = list_pop_head(s, LIST_RECENT);
+    if(s->lists[LIST_GHOST_RECENT].len >= twoq_kout(s)){
+      ghost_drop_head(s, LIST_GHOST_RECENT);
+    }
+    ghost_add(s, LIST_GHOST_RECENT, i);
+    return i;
+  }
+  return list_pop_head(s, LIST_FREQUENT);
+}
+
+static void twoq_admit(cache_shard_t *s, int i){
+  list_push_tail(s, s->pending_list == LIST_FREQUENT ? LIST_FREQUENT : LIST_RECENT, i);
+  s->pending_list = LIST_NONE;
+}
+
+static void twoq_hit(cache_shard_t *s, int i){
+  if(s->where[i] == LIST_FREQUENT){
+    list_move_tail(s, LIST_FREQUENT, i);
+  }
+}
+
+static const cache_policy_ops_t twoq_ops = {twoq_miss, twoq_evict, twoq_admit, twoq_hit, false};
+
+//ARC: T1 holds blocks seen once recently and T2 blocks seen at least twice. B1 and B2 remember what was evicted from
+//each, and a miss that hits one of them moves arc_p, the target size of T1, towards the list that would have kept it
+static void arc_miss(cache_shard_t *s, uint16_t key){
+  int from = ghost_take(s, key);
+  int b1 = s->lists[LIST_GHOST_RECENT].len;
+  int b2 = s->lists[LIST_GHOST_FREQUENT].len;
+  s->pending_from_ghost_frequent = false;
+  if(from == LIST_GHOST_RECENT){
+    //the ghost was already dropped, so count it back in when sizing the adjustment
+    int delta = b2 / (b1 + 1) > 1 ? b2 / (b1 + 1) : 1;
+    s->arc_p = s->arc_p + delta < s->size ? s->arc_p + delta : s->size;
+    s->pending_list = LIST_FREQUENT;
+  }
+  else if(from == LIST_GHOST_FREQUENT){
+    int delta = b1 / (b2 + 1) > 1 ? b1 / (b2 + 1) : 1;
+    s->arc_p = s->arc_p - delta > 0 ? s->arc_p - delta : 0;
+    s->pending_list = LIST_FREQUENT;
+    s->pending_from_ghost_frequent = true;
+  }
+  else{
+    s->pending_list = LIST_RECENT;
+  }
+}
+
+//ARC's REPLACE: evict from T1 into B1 if T1 is over its target, otherwise from T2 into B2
+static int arc_replace(cache_shard_t *s){
+  int t1 = s->lists[LIST_RECENT].len;
+  if(t1 >= 1 && (t1 > s->arc_p || (s->pending_from_ghost_frequent && t1 == s->arc_p) ||
+                 s->lists[LIST_FREQUENT].len == 0)){
+    int i = list_pop_head(s, LIST_RECENT);
+    ghost_add(s, LIST_GHOST_RECENT, i);
+    return i;
+  }
+  int i = list_pop_head(s, LIST_FREQUENT);
+  ghost_add(s, LIST_GHOST_FREQUENT, i);
+  return i;
+}
+
+static int arc_evict(cache_shard_t *s){
+  if(s->pending_list == LIST_RECENT){
+    //a brand new block: keep |T1| + |B1| <= c and the whole directory <= 2c
+    int l1 = s->lists[LIST_RECENT].len + s->lists[LIST_GHOST_RECENT].len;
+    int total = l1 + s->lists[LIST_FREQUENT].len + s->lists[LIST_GHOST_FREQUENT].len;
+    if(l1 >= s->size){
+      if(s->lists[LIST_RECENT].len < s->size){
+        ghost_drop_head(s, LIST_GHOST_RECENT);
+      }
+      else{
+        return list_pop_head(s, LIST_RECENT);
+      }
+    }
+    else if(total >= 2 * s->size && s->lists[LIST_GHOST_FREQUENT].len > 0){
+      ghost_drop_head(s, LIST_GHOST_FREQUENT);
+    }
+  }
+  return arc_replace(s);
+}
+
+static void arc_admit(cache_shard_t *s, int i){
+  list_push_tail(s, s->pending_list == LIST_FREQUENT ? LIST_FREQUENT : LIST_RECENT, i);
+  s->pending_list = LIST_NONE;
+  s->pending_from_ghost_frequent = false;
+}
+
+static void arc_hit(cache_shard_t *s, int i){
+  list_move_tail(s, LIST_FREQUENT, i);
 }
 
-//helper function to move cache entry at index i to either last valid entry (if cache not full) or last index (if cache full),
-//shifting everything in between i and its destination one spot to the left.
-//called whenever an entry is inserted or update to maintain order of cache where least recently used are at the front and
-//most recently used are at the end
-void move_entry(int i){
-  //create temp variable holding entry at index i
-  cache_entry_t temp = cache[i];
-  int j;
-  //iterate through loop, shifting each entry 1 spot to the left until reach the end of cache or invalid entry is found
-  for(j = i; j < cache_size - 1; j++){
-    if(cache[j + 1].valid == false){
-      break;
+static const cache_policy_ops_t arc_ops = {arc_miss, arc_evict, arc_admit, arc_hit, false};
+
+static const cache_policy_ops_t *policy_ops[CACHE_NUM_POLICIES] = {&mru_ops, &lru_ops, &clock_ops, &twoq_ops, &arc_ops};
+
+//helper function to empty every list of shard s and (re)build its free lists so that they hold every resident entry
+//from index |from| up to its size and every ghost node
+static void lists_init(cache_shard_t *s, int from){
+  for(int id = 0; id < NUM_LISTS; id++){
+    s->lists[id].head = -1;
+    s->lists[id].tail = -1;
+    s->lists[id].len = 0;
+  }
+  s->free_head = -1;
+  for(int i = s->size - 1; i >= from; i--){
+    s->tags[i] = CACHE_TAG_INVALID;
+    s->ref[i] = 0;
+    s->dirty[i] = 0;
+    s->prev[i] = -1;
+    s->next[i] = s->free_head;
+    s->where[i] = LIST_NONE;
+    s->free_head = i;
+  }
+  s->ghost_free_head = -1;
+  for(int node = 2 * s->size - 1; node >= s->size; node--){
+    s->prev[node] = -1;
+    s->next[node] = s->ghost_free_head;
+    s->where[node] = LIST_NONE;
+    s->ghost_free_head = node;
+  }
+  for(int key = s->id; key < NUM_KEYS; key += num_shards){
+    ghost_index[key] = -1;
+  }
+  s->pending_list = LIST_NONE;
+  s->pending_from_ghost_frequent = false;
+}
+
+//helper function to allocate the per-entry arrays, list nodes and payload slab of shard s for num_entries entries.
+//the tag array and slab are aligned to a cache line so a probe never straddles two lines. returns false if any
+//allocation fails
+static bool cache_alloc(cache_shard_t *s, int num_entries){
+  size_t tag_bytes = (num_entries * sizeof(uint16_t) + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+  s->tags = (uint16_t *)aligned_alloc(CACHE_LINE_SIZE, tag_bytes);
+  s->ref = (uint8_t *)malloc(num_entries);
+  s->dirty = (uint8_t *)malloc(num_entries);
+  s->slab = (uint8_t *)aligned_alloc(CACHE_LINE_SIZE, (size_t)num_entries * JBOD_BLOCK_SIZE);
+  s->prev = (int16_t *)malloc(2 * num_entries * sizeof(int16_t));
+  s->next = (int16_t *)malloc(2 * num_entries * sizeof(int16_t));
+  s->where = (uint8_t *)malloc(2 * num_entries);
+  s->ghost_tags = (uint16_t *)malloc(num_entries * sizeof(uint16_t));
+  return s->tags != NULL && s->ref != NULL && s->dirty != NULL && s->slab != NULL && s->prev != NULL &&
+         s->next != NULL && s->where != NULL && s->ghost_tags != NULL;
+}
+
+//helper function to free the per-entry arrays, list nodes and slab of shard s and reset the pointers
+static void cache_free(cache_shard_t *s){
+  free(s->tags);
+  free(s->ref);
+  free(s->dirty);
+  free(s->slab);
+  free(s->prev);
+  free(s->next);
+  free(s->where);
+  free(s->ghost_tags);
+  s->tags = NULL;
+  s->ref = NULL;
+  s->dirty = NULL;
+  s->slab = NULL;
+  s->prev = NULL;
+  s->next = NULL;
+  s->where = NULL;
+  s->ghost_tags = NULL;
+}
+
+//helper function to point shard s's readers at its current arrays through view, retiring the view they used before
+static void view_publish(cache_shard_t *s, shard_view_t *view){
+  view->size = s->size;
+  view->slab = s->slab;
+  view->ref = s->ref;
+  view->retired = s->view;
+  __atomic_store_n(&s->view, view, __ATOMIC_RELEASE);
+}
+
+//helper function to free every shard, with the arrays of the views it retired, and the shard array
+static void shards_free(void){
+  for(int n = 0; n < num_shards; n++){
+    cache_shard_t *s = &shards[n];
+    for(shard_view_t *v = s->view, *older; v != NULL; v = older){
+      older = v->retired;
+      if(v != s->view){
+        free(v->slab);
+        free(v->ref);
+      }
+      free(v);
+    }
+    cache_free(s);
+    pthread_mutex_destroy(&s->lock);
+  }
+  free(shards);
+  shards = NULL;
+  num_shards = 0;
+}
+
+//helper function to get the number of entries shard n gets out of num_entries: an even share, with the remainder
+//going to the first shards
+static int shard_entries(int n, int num_entries){
+  return num_entries / num_shards + (n < num_entries % num_shards ? 1 : 0);
+}
+
+//helper function to forget that key, about to leave shard s or be overwritten, was prefetched, counting the prefetch
+//as wasted if no lookup got to it first
+static void prefetch_drop(cache_shard_t *s, uint16_t key){
+  if(__atomic_load_n(&prefetched[key], __ATOMIC_RELAXED) && __atomic_exchange_n(&prefetched[key], 0, __ATOMIC_RELAXED)){
+    s->stats->num_prefetches_wasted++;
+  }
+}
+
+//helper function to write back dirty entry i of shard s and mark it clean. returns 1 on success and -1 on failure
+static int cache_clean(cache_shard_t *s, int i){
+  if(writeback == NULL || writeback(s->tags[i] >> 8, s->tags[i] & 0xff, cache_block(s, i)) != 1){
+    return -1;
+  }
+  s->dirty[i] = 0;
+  s->stats->num_writebacks++;
+  stats_count(STATS_CACHE_WRITEBACKS);
+  return 1;
+}
+
+//helper function to have the policy pick a victim in shard s, write it back if it is dirty and drop it from the
+//index. returns the freed entry, or -1 if the victim could not be written back, in which case it stays cached
+static int cache_evict_one(cache_shard_t *s){
+  s->num_dropped = 0;
+  int i = policy->evict(s);
+  if(s->dirty[i] && cache_clean(s, i) == -1){
+    //undo the eviction: the policy may already have remembered the victim as a ghost, which it must not be while it
+    //is resident, and dropped older ghosts to make room for it. those go back to the heads they were dropped from,
+    //newest first, and the victim to its old place on its old list
+    ghost_remove(s, s->tags[i]);
+    while(s->num_dropped > 0){
+      s->num_dropped--;
+      ghost_restore(s, s->dropped_list[s->num_dropped], -1, s->dropped_key[s->num_dropped]);
+    }
+    list_insert_after(s, s->victim_list, s->victim_prev, i);
+    return -1;
+  }
+  index_set(s->tags[i], -1);
+  prefetch_drop(s, s->tags[i]);
+  s->stats->num_evictions++;
+  stats_count(STATS_CACHE_EVICTIONS);
+  return i;
+}
+
+//helper function to overwrite resident entry i of shard s with buf and let the policy record the access
+static void shard_update(cache_shard_t *s, int i, const uint8_t *buf){
+  seq_write_begin(s);
+  block_store(cache_block(s, i), buf);
+  seq_write_end(s);
+  bump_version(s->tags[i]);
+  prefetch_drop(s, s->tags[i]);
+  policy->hit(s, i);
+}
+
+//helper function to admit key with contents buf into shard s, which does not hold it yet, taking a free entry or
+//evicting one. returns the entry, or -1 if a dirty victim could not be written back. readers of the shard go to its
+//lock until this is done, including while a dirty victim is written back
+static int shard_admit(cache_shard_t *s, uint16_t key, const uint8_t *buf){
+  int arc_p = s->arc_p;
+  seq_write_begin(s);
+  s->taken_list = LIST_NONE;
+  if(policy->miss != NULL){
+    policy->miss(s, key);
+  }
+  //take a free entry if there is one, otherwise let the policy pick a victim
+  int i;
+  if(s->free_head != -1){
+    i = s->free_head;
+    s->free_head = s->next[i];
+  }
+  else{
+    i = cache_evict_one(s);
+    if(i == -1){
+      //the block is not coming in after all, so neither is the ghost its miss took gone, nor has ARC's target moved
+      ghost_untake(s);
+      s->arc_p = arc_p;
+      s->pending_list = LIST_NONE;
+      s->pending_from_ghost_frequent = false;
+      seq_write_end(s);
+      return -1;
+    }
+  }
+  //fill in the entry with values passed to function and hand it to the policy
+  s->tags[i] = key;
+  s->dirty[i] = 0;
+  block_store(cache_block(s, i), buf);
+  index_set(key, i);
+  policy->admit(s, i);
+  s->stats->num_inserts++;
+  stats_count(STATS_CACHE_INSERTS);
+  seq_write_end(s);
+  return i;
+}
+
+const char *cache_policy_name(cache_policy_t p) {
+  if(p < 0 || p >= CACHE_NUM_POLICIES){
+    return "unknown";
+  }
+  return policy_names[p];
+}
+
+int cache_policy_from_name(const char *name) {
+  for(int p = 0; p < CACHE_NUM_POLICIES; p++){
+    if(strcasecmp(name, policy_names[p]) == 0){
+      return p;
     }
-    cache[j] = cache[j + 1];
   }
-  //after exiting the loop, i will either be equal to cache_size - 1 or the index of the last valid entry
-  //place temp at either the last valid entry (if not full) or end of array (if full)
-  cache[j] = temp;
+  return -1;
 }
 
 int cache_create(int num_entries) {
-  //if cache already enabled or num_entries not in valid range, return -1
+  return cache_create_with_policy(num_entries, CACHE_POLICY_MRU);
+}
+
+int cache_create_with_policy(int num_entries, cache_policy_t p) {
+  return cache_create_sharded(num_entries, p, 1);
+}
+
+int cache_create_sharded(int num_entries, cache_policy_t p, int n) {
+  //if cache already enabled or num_entries, policy or shard count not in valid range, return -1
   if(cache_enabled()){
     return -1;
   }
   if(num_entries < 2 || num_entries > 4096){
     return -1;
   }
+  if(p < 0 || p >= CACHE_NUM_POLICIES){
+    return -1;
+  }
+  if(n < 1 || n > CACHE_MAX_SHARDS){
+    return -1;
+  }
+  //every shard needs room for at least two entries
+  if(n > num_entries / 2){
+    n = num_entries / 2;
+  }
 
-  //allocate zero'd out memory for num_entries of cache_entries
-  cache = (cache_entry_t *)calloc(num_entries, sizeof(cache_entry_t));
-  if(cache == NULL){
+  shards = (cache_shard_t *)aligned_alloc(CACHE_LINE_SIZE, n * sizeof(cache_shard_t));
+  if(shards == NULL){
     return -1;
   }
-  cache_size = num_entries;
+  memset(shards, 0, n * sizeof(cache_shard_t));
+  num_shards = n;
+  memset(stats, 0, sizeof(stats));
+  num_stats = n;
+  hits_at_create = stats_counter_total(STATS_CACHE_HITS);
+  misses_at_create = stats_counter_total(STATS_CACHE_MISSES);
+  prefetch_hits_at_create = stats_counter_total(STATS_CACHE_PREFETCH_HITS);
+  policy = policy_ops[p];
+  policy_id = p;
+
+  //every entry starts out on its shard's free list and nothing is indexed
+  memset(cache_index, -1, sizeof(cache_index));
+  memset(prefetched, 0, sizeof(prefetched));
+  for(int k = 0; k < num_shards; k++){
+    cache_shard_t *s = &shards[k];
+    pthread_mutex_init(&s->lock, NULL);
+    s->id = k;
+    s->stats = &stats[k];
+    s->size = shard_entries(k, num_entries);
+    //allocate the per-entry arrays for the shard's entries
+    shard_view_t *view = malloc(sizeof(*view));
+    if(view == NULL || !cache_alloc(s, s->size)){
+      free(view);
+      shards_free();
+      return -1;
+    }
+    lists_init(s, 0);
+    view_publish(s, view);
+  }
   return 1;
 }
 
@@ -72,15 +866,23 @@ int cache_destroy(void) {
   if(!cache_enabled()){
     return -1;
   }
-  //cache enabled, so free memory, set point to NULL, and set cache_size to 0 and return 1
-  free(cache);
-  cache = NULL;
-  cache_size = 0;
+  //dirty blocks must reach the JBOD before their only copy is freed
+  if(cache_flush() == -1){
+    return -1;
+  }
+  //prefetched blocks nobody looked up were read for nothing
+  for(int key = 0; key < NUM_KEYS; key++){
+    if(prefetched[key]){
+      prefetched[key] = 0;
+      shard_of(key)->stats->num_prefetches_wasted++;
+    }
+  }
+  //cache enabled, so free every shard and return 1
+  shards_free();
   return 1;
 }
 
 int cache_lookup(int disk_num, int block_num, uint8_t *buf) {
-  //might need to check if buf is NULL
   //check to make sure there is a cache, return -1 if no cache
   if(!cache_enabled()){
     return -1;
@@ -88,43 +890,48 @@ int cache_lookup(int disk_num, int block_num, uint8_t *buf) {
   if(buf == NULL){
     return -1;
   }
-  //increment num_queries
-  num_queries++;
-  //find index of cache entry we are looking for
-  int i = cache_search(disk_num, block_num);
-  //if entry not in cache, return -1
-  if(i == -1){
+  if(!cache_key_valid(disk_num, block_num)){
     return -1;
   }
-  //entry in cache, so increment num_hits, copy its block into buffer, update timestamp, and return 1
-  num_hits++;
-  memcpy(buf, cache[i].block, JBOD_BLOCK_SIZE);
-  cache[i].clock_accesses = clock;
-  //move cache entry to end of array since most recently used
-  move_entry(i);
-  return 1;
+  uint16_t key = cache_key(disk_num, block_num);
+  cache_shard_t *s = shard_of(key);
+  //a policy that only needs the reference bit set can be served without the lock
+  int rc = policy->lockless_hit ? lockless_copy(s, key, buf, true) : 0;
+  if(rc == 0){
+    pthread_mutex_lock(&s->lock);
+    //find index of cache entry we are looking for
+    int i = cache_index[key];
+    //entry in cache, so copy its block into buffer and let the policy record the access
+    if(i != -1){
+      memcpy(buf, cache_block(s, i), JBOD_BLOCK_SIZE);
+      policy->hit(s, i);
+    }
+    pthread_mutex_unlock(&s->lock);
+    rc = i == -1 ? -1 : 1;
+  }
+  stats_count(rc == 1 ? STATS_CACHE_HITS : STATS_CACHE_MISSES);
+  //the first hit on a prefetched block is the prefetch paying off
+  if(rc == 1 && __atomic_load_n(&prefetched[key], __ATOMIC_RELAXED) &&
+     __atomic_exchange_n(&prefetched[key], 0, __ATOMIC_RELAXED)){
+    stats_count(STATS_CACHE_PREFETCH_HITS);
+  }
+  return rc;
 }
 
 void cache_update(int disk_num, int block_num, const uint8_t *buf) {
-  //check to make sure there is a cache, return -1 if no cache
-  if(!cache_enabled()){
+  //check to make sure there is a cache, return if no cache
+  if(!cache_enabled() || buf == NULL || !cache_key_valid(disk_num, block_num)){
     return;
   }
-  if(buf == NULL){
-    return;
-  }
-  //find index of cache entry we are looking for
-  int i = cache_search(disk_num, block_num);
-  //if entry not in cache, return -1
-  if(i == -1){
-    return;
+  uint16_t key = cache_key(disk_num, block_num);
+  cache_shard_t *s = shard_of(key);
+  pthread_mutex_lock(&s->lock);
+  //if entry in cache, copy buf into its block
+  int i = cache_index[key];
+  if(i != -1){
+    shard_update(s, i, buf);
   }
-  //entry in cache, copy buf into its block, update timestamp, and return 1
-  memcpy(cache[i].block, buf, JBOD_BLOCK_SIZE);
-  cache[i].clock_accesses = clock;
-  //move cache entry to end of array since most recently used
-  move_entry(i);
-  return;
+  pthread_mutex_unlock(&s->lock);
 }
 
 int cache_insert(int disk_num, int block_num, const uint8_t *buf) {
@@ -135,78 +942,295 @@ int cache_insert(int disk_num, int block_num, const uint8_t *buf) {
   if(buf == NULL){
     return -1;
   }
-  if(disk_num < 0 || disk_num > JBOD_NUM_DISKS || block_num < 0 || block_num > JBOD_NUM_BLOCKS_PER_DISK){
+  if(!cache_key_valid(disk_num, block_num)){
     return -1;
   }
+  uint16_t key = cache_key(disk_num, block_num);
+  cache_shard_t *s = shard_of(key);
+  int rc = 1;
+  pthread_mutex_lock(&s->lock);
+  //whatever happens below, a fill that read the JBOD before this insert must not land after it
+  bump_version(key);
   //if passed entry already in cache, update if buf is different than its block, if buf is same as its block, do nothing
-  int j = cache_search(disk_num, block_num);
-  //if passed entry in cache
+  int j = cache_index[key];
   if(j != -1){
     //if buf is equal to passed entry's current block, do nothing and return -1
-    if(memcmp(cache[j].block, buf, JBOD_BLOCK_SIZE) == 0){
-      return -1;
+    if(memcmp(cache_block(s, j), buf, JBOD_BLOCK_SIZE) == 0){
+      rc = -1;
     }
     //if here, passed entry is in cache, however buf is not equal to its block, so update its block to buf
-    cache_update(disk_num, block_num, buf);
-    return 1;
+    else{
+      shard_update(s, j, buf);
+    }
   }
-  //find first empty cache index, or, if cache full, last index which will be most recently used
-  int i;
-  for(i = 0; i < cache_size - 1; i++){
-    clock++;
-    if(cache[i].valid == false){
-      break;
+  else if(shard_admit(s, key, buf) == -1){
+    rc = -1;
+  }
+  pthread_mutex_unlock(&s->lock);
+  if(rc == -1){
+    stats_count(STATS_CACHE_INSERT_REJECTS);
+  }
+  return rc;
+}
+
+uint32_t cache_version(int disk_num, int block_num) {
+  if(!cache_key_valid(disk_num, block_num)){
+    return 0;
+  }
+  return __atomic_load_n(&versions[cache_key(disk_num, block_num)], __ATOMIC_ACQUIRE);
+}
+
+//helper function behind cache_fill and cache_prefetch, which only differ in whether the block is marked prefetched
+static int fill(int disk_num, int block_num, const uint8_t *buf, uint32_t version, bool prefetch){
+  if(!cache_enabled() || buf == NULL || !cache_key_valid(disk_num, block_num)){
+    return -1;
+  }
+  uint16_t key = cache_key(disk_num, block_num);
+  cache_shard_t *s = shard_of(key);
+  int rc = -1;
+  pthread_mutex_lock(&s->lock);
+  //a cached copy is at least as new as anything read from the JBOD, and may be a dirty one the JBOD has not seen
+  if(versions[key] == version && cache_index[key] == -1 && shard_admit(s, key, buf) != -1){
+    rc = 1;
+    if(prefetch){
+      __atomic_store_n(&prefetched[key], 1, __ATOMIC_RELAXED);
+      s->stats->num_prefetches++;
+    }
+  }
+  pthread_mutex_unlock(&s->lock);
+  if(rc == -1){
+    stats_count(STATS_CACHE_INSERT_REJECTS);
+  }
+  return rc;
+}
+
+int cache_fill(int disk_num, int block_num, const uint8_t *buf, uint32_t version) {
+  return fill(disk_num, block_num, buf, version, false);
+}
+
+int cache_prefetch(int disk_num, int block_num, const uint8_t *buf, uint32_t version) {
+  return fill(disk_num, block_num, buf, version, true);
+}
+
+int cache_write(int disk_num, int block_num, const uint8_t *buf) {
+  if(!cache_enabled() || buf == NULL || !cache_key_valid(disk_num, block_num)){
+    return -1;
+  }
+  uint16_t key = cache_key(disk_num, block_num);
+  cache_shard_t *s = shard_of(key);
+  int rc = 1;
+  pthread_mutex_lock(&s->lock);
+  bump_version(key);
+  int i = cache_index[key];
+  if(i == -1){
+    i = shard_admit(s, key, buf);
+    if(i == -1){
+      rc = -1;
+      stats_count(STATS_CACHE_INSERT_REJECTS);
     }
+    else{
+      s->dirty[i] = 1;
+    }
+  }
+  //a cached copy that already holds exactly these bytes needs nothing more
+  else if(memcmp(cache_block(s, i), buf, JBOD_BLOCK_SIZE) != 0){
+    shard_update(s, i, buf);
+    s->dirty[i] = 1;
+  }
+  pthread_mutex_unlock(&s->lock);
+  return rc;
+}
+
+int cache_peek(int disk_num, int block_num, uint8_t *buf) {
+  if(!cache_enabled() || buf == NULL || !cache_key_valid(disk_num, block_num)){
+    return -1;
+  }
+  uint16_t key = cache_key(disk_num, block_num);
+  cache_shard_t *s = shard_of(key);
+  //a peek is not a use, so under any policy it only has to copy the block
+  int rc = lockless_copy(s, key, buf, false);
+  if(rc != 0){
+    return rc;
+  }
+  pthread_mutex_lock(&s->lock);
+  int i = cache_index[key];
+  if(i != -1){
+    memcpy(buf, cache_block(s, i), JBOD_BLOCK_SIZE);
+  }
+  pthread_mutex_unlock(&s->lock);
+  return i == -1 ? -1 : 1;
+}
+
+int cache_mark_dirty(int disk_num, int block_num) {
+  if(!cache_enabled() || !cache_key_valid(disk_num, block_num)){
+    return -1;
+  }
+  uint16_t key = cache_key(disk_num, block_num);
+  cache_shard_t *s = shard_of(key);
+  pthread_mutex_lock(&s->lock);
+  int i = cache_index[key];
+  if(i != -1){
+    s->dirty[i] = 1;
+  }
+  pthread_mutex_unlock(&s->lock);
+  return i == -1 ? -1 : 1;
+}
+
+void cache_set_writeback(cache_writeback_t fn) {
+  writeback = fn;
+}
+
+//dirty entries are found through cache_index rather than by walking the entries, so they are written back in
+//ascending (disk_num, block_num) order and the JBOD head only ever moves forward
+int cache_flush(void) {
+  if(!cache_enabled()){
+    return -1;
   }
-  //replace most recently used entry with values passed to function
-  cache[i].disk_num = disk_num;
-  cache[i].block_num = block_num;
-  cache[i].clock_accesses = clock;
-  cache[i].valid = true;
-  memcpy(cache[i].block, buf, JBOD_BLOCK_SIZE);
-  if(i != cache_size - 1){
-    move_entry(i);
+  for(int key = 0; key < NUM_KEYS; key++){
+    cache_shard_t *s = shard_of(key);
+    pthread_mutex_lock(&s->lock);
+    int i = cache_index[key];
+    int rc = i != -1 && s->dirty[i] ? cache_clean(s, i) : 1;
+    pthread_mutex_unlock(&s->lock);
+    if(rc == -1){
+      return -1;
+    }
   }
   return 1;
 }
 
 bool cache_enabled(void) {
-  return cache != NULL;
+  return shards != NULL;
+}
+
+void cache_get_hits(int *num_hits, int *num_queries) {
+  *num_hits = stats_counter_total(STATS_CACHE_HITS) - hits_at_create;
+  *num_queries = *num_hits + (int)(stats_counter_total(STATS_CACHE_MISSES) - misses_at_create);
 }
 
 void cache_print_hit_rate(void) {
+  int num_hits = 0, num_queries = 0, num_inserts = 0, num_evictions = 0, num_ghost_hits = 0, num_writebacks = 0;
+  int num_prefetches = 0, num_prefetches_wasted = 0;
+  int num_prefetch_hits = stats_counter_total(STATS_CACHE_PREFETCH_HITS) - prefetch_hits_at_create;
+  cache_get_hits(&num_hits, &num_queries);
+  for(int n = 0; n < num_stats; n++){
+    if(n < num_shards){
+      pthread_mutex_lock(&shards[n].lock);
+    }
+    num_inserts += stats[n].num_inserts;
+    num_evictions += stats[n].num_evictions;
+    num_ghost_hits += stats[n].num_ghost_hits;
+    num_writebacks += stats[n].num_writebacks;
+    num_prefetches += stats[n].num_prefetches;
+    num_prefetches_wasted += stats[n].num_prefetches_wasted;
+    if(n < num_shards){
+      pthread_mutex_unlock(&shards[n].lock);
+    }
+  }
 	fprintf(stderr, "num_hits: %d, num_queries: %d\n", num_hits, num_queries);
   fprintf(stderr, "Hit rate: %5.1f%%\n", 100 * (float) num_hits / num_queries);
+  fprintf(stderr, "Policy: %s, inserts: %d, evictions: %d, ghost hits: %d, write-backs: %d\n",
+          cache_policy_name(policy_id), num_inserts, num_evictions, num_ghost_hits, num_writebacks);
+  //prefetched blocks still cached and not yet looked up count as neither hits nor waste until they leave
+  if(num_prefetches > 0){
+    fprintf(stderr, "Prefetches: %d, prefetch hits: %d (%.1f%%), wasted: %d (%.1f%%)\n", num_prefetches,
+            num_prefetch_hits, 100 * (float) num_prefetch_hits / num_prefetches, num_prefetches_wasted,
+            100 * (float) num_prefetches_wasted / num_prefetches);
+  }
 }
 
+//helper function to resize shard s to new_size entries, with its lock held. when shrinking, the policy evicts entries
+//until the rest fit, so under MRU the most recently used entries are the ones removed. the survivors are copied to
+//the front of fresh arrays, list by list in recency order, and everything past them becomes free entries. ghost lists
+//are forgotten since their nodes are sized by the old shard
+static int shard_resize(cache_shard_t *s, int new_size){
+  shard_view_t *view = malloc(sizeof(*view));
+  if(view == NULL){
+    return -1;
+  }
+  seq_write_begin(s);
+  //let the policy choose which entries go until the rest fit
+  while(s->lists[LIST_RECENT].len + s->lists[LIST_FREQUENT].len > new_size){
+    s->pending_list = LIST_RECENT;
+    if(cache_evict_one(s) == -1){
+      s->pending_list = LIST_NONE;
+      seq_write_end(s);
+      free(view);
+      return -1;
+    }
+  }
+  s->pending_list = LIST_NONE;
+
+  //save the old arrays, then allocate fresh ones and copy the survivors over
+  cache_shard_t old = *s;
+  if(!cache_alloc(s, new_size)){
+    cache_free(s);
+    s->tags = old.tags;
+    s->ref = old.ref;
+    s->dirty = old.dirty;
+    s->slab = old.slab;
+    s->where = old.where;
+    s->prev = old.prev;
+    s->next = old.next;
+    s->ghost_tags = old.ghost_tags;
+    seq_write_end(s);
+    free(view);
+    return -1;
+  }
+  s->size = new_size;
+  int kept = 0;
+  for(int id = LIST_RECENT; id <= LIST_FREQUENT; id++){
+    for(int i = old.lists[id].head; i != -1; i = old.next[i]){
+      s->tags[kept] = old.tags[i];
+      s->ref[kept] = __atomic_load_n(&old.ref[i], __ATOMIC_RELAXED);
+      s->dirty[kept] = old.dirty[i];
+      memcpy(cache_block(s, kept), &old.slab[(size_t)i * JBOD_BLOCK_SIZE], JBOD_BLOCK_SIZE);
+      kept++;
+    }
+  }
+  //the old slab and reference bits stay with the old view, which readers may still be using
+  old.slab = NULL;
+  old.ref = NULL;
+  cache_free(&old);
 
-//cache is ordered so that elements are in order of recent use with least recently used being at index 0 and most recently
-//used being at either the last index (if cache is full) or the last valid entry (if cache is not full), so when reallocing
-//to smaller size, the end of cache (most recently used entries or invalid entries) will automatically be the entries removed
+  //rebuild the index, lists and free lists around the survivors
+  lists_init(s, kept);
+  for(int key = s->id; key < NUM_KEYS; key += num_shards){
+    index_set(key, -1);
+  }
+  int k = 0;
+  for(int id = LIST_RECENT; id <= LIST_FREQUENT; id++){
+    for(int n = 0; n < old.lists[id].len; n++, k++){
+      index_set(s->tags[k], k);
+      list_push_tail(s, id, k);
+    }
+  }
+  if(s->arc_p > s->size){
+    s->arc_p = s->size;
+  }
+  view_publish(s, view);
+  seq_write_end(s);
+  return 1;
+}
+
+//the new entries are shared out over the shards the way cache_create_sharded shares them. the number of shards stays
+//the same, so a cache cannot shrink below two entries per shard
 int cache_resize(int new_num_entries) {
   //check to make sure there is a cache, return -1 if no cache
   if(!cache_enabled()){
     return -1;
   }
-  if(new_num_entries < 2 || new_num_entries > 4096){
+  if(new_num_entries < 2 * num_shards || new_num_entries > 4096){
     return -1;
   }
-  //attempt realloc, store result in  *ptr
-  cache_entry_t *ptr = (cache_entry_t *)realloc(cache, new_num_entries * sizeof(cache_entry_t));
-  //if ptr is NULL, realloc must have failed, so return -1
-  if(ptr == NULL){
-    return -1;
-  }
-  //if here, realloc successful, set cache to ptr returned by realloc
-  cache = ptr;
-
-  //if new size is bigger, insert invalid (zero'd out) entries
-  if(new_num_entries > cache_size){
-    //need to insert new_num_entries - cache_size number of new, invalid entries (zero out their memory)
-    memset(&cache[cache_size], 0, (new_num_entries - cache_size) * sizeof(cache_entry_t));
+  for(int n = 0; n < num_shards; n++){
+    cache_shard_t *s = &shards[n];
+    pthread_mutex_lock(&s->lock);
+    int rc = shard_resize(s, shard_entries(n, new_num_entries));
+    pthread_mutex_unlock(&s->lock);
+    if(rc == -1){
+      return -1;
+    }
   }
-
-  //update cache_size to new size
-  cache_size = new_num_entries;
   return 1;
-}
\ No newline at end of file
+}
@@ -7,21 +7,66 @@
 #include "jbod.h"
 #include "util.h"
 
-typedef struct {
-  bool valid;
-  int disk_num;
-  int block_num;
-  uint8_t block[JBOD_BLOCK_SIZE];
-  int clock_accesses;
-} cache_entry_t;
-
-/* Returns 1 on success and -1 on failure. Should allocate a space for
- * |num_entries| cache entries, each of type cache_entry_t. Calling it again
- * without first calling cache_destroy (see below) should fail. */
+/* Size in bytes of a CPU cache line. The cache's tag array and payload slab are
+ * aligned to it. */
+#define CACHE_LINE_SIZE 64
+
+/* The most shards a cache can be split into (see cache_create_sharded). */
+#define CACHE_MAX_SHARDS 64
+
+/* Tag value stored for an entry that does not hold a block. Valid tags pack
+ * the disk number into the high bits and the block number into the low 8 bits,
+ * so they never reach this value. */
+#define CACHE_TAG_INVALID 0xffff
+
+/* Called with a dirty block's location and contents when the block has to
+ * leave the cache. Should return 1 once the block is on the JBOD and -1 if it
+ * could not be written. */
+typedef int (*cache_writeback_t)(int disk_num, int block_num, const uint8_t *buf);
+
+/* Eviction policies the cache can be created with. */
+typedef enum {
+  CACHE_POLICY_MRU,
+  CACHE_POLICY_LRU,
+  CACHE_POLICY_CLOCK,
+  CACHE_POLICY_2Q,
+  CACHE_POLICY_ARC,
+  CACHE_NUM_POLICIES,
+} cache_policy_t;
+
+/* Returns 1 on success and -1 on failure. Should allocate space for
+ * |num_entries| cache entries: a packed tag array describing the entries and
+ * a slab holding their JBOD_BLOCK_SIZE payloads. Calling it again without
+ * first calling cache_destroy (see below) should fail. */
 int cache_create(int num_entries);
 
-/* Returns 1 on success and -1 on failure. Frees the space allocated by
- * cache_create function above. */
+/* Same as cache_create, but evicts entries according to |policy| instead of
+ * always evicting the most recently used entry. */
+int cache_create_with_policy(int num_entries, cache_policy_t policy);
+
+/* Same as cache_create_with_policy, but splits the cache into |num_shards|
+ * shards (at most CACHE_MAX_SHARDS, and at most one per two entries), each
+ * caching its share of the blocks with its share of the entries, its own
+ * policy state and its own lock. Every function below is safe to call from
+ * several threads at once (except cache_create*, cache_destroy and
+ * cache_set_writeback), and threads only contend when their blocks fall in
+ * the same shard; with more than one shard the policy picks victims within a
+ * shard rather than across the whole cache. Lookups under CLOCK, whose hits
+ * only set a reference bit, and peeks under any policy copy the block without
+ * taking a lock at all (each shard is a seqlock), so readers only ever wait
+ * for a writer changing their own shard. */
+int cache_create_sharded(int num_entries, cache_policy_t policy, int num_shards);
+
+/* Returns the printable name of |policy|, e.g. "LRU". */
+const char *cache_policy_name(cache_policy_t policy);
+
+/* Returns the policy named |name| (case insensitive), or -1 if there is no
+ * such policy. */
+int cache_policy_from_name(const char *name);
+
+/* Returns 1 on success and -1 on failure. Writes back any dirty entries (see
+ * cache_flush) and frees the space allocated by cache_create function above.
+ * Fails without freeing anything if a dirty entry cannot be written back. */
 int cache_destroy(void);
 
 /* Returns 1 on success and -1 on failure. Looks up the block located at
@@ -31,24 +76,72 @@ int cache_lookup(int disk_num, int block_num, uint8_t *buf);
 
 /* Returns 1 on success and -1 on failure. Inserts an entry for |disk_num| and
  * |block_num| into cache. Returns -1 if there is already an existing entry in the cache
- * with |disk_num| and |block_num|.If there cache is full, should evict most
- * recently used entry and insert the new entry. */
+ * with |disk_num| and |block_num|.If there cache is full, should evict an
+ * entry chosen by the cache's policy (the most recently used entry for
+ * cache_create) and insert the new entry. A dirty victim is written back
+ * first, and if that fails the insert fails and the victim stays cached. */
 int cache_insert(int disk_num, int block_num, const uint8_t *buf);
 
+/* Returns the version of the block at |disk_num| and |block_num|, which
+ * changes whenever it is inserted, updated or written. Take it before reading
+ * the block from the JBOD and hand it to cache_fill. */
+uint32_t cache_version(int disk_num, int block_num);
+
+/* Returns 1 on success and -1 on failure. Inserts a block just read from the
+ * JBOD, like cache_insert, unless the block is already cached or its version
+ * is no longer |version|: another thread has cached a newer copy since the
+ * read started, and that copy must not be replaced by an older one. */
+int cache_fill(int disk_num, int block_num, const uint8_t *buf, uint32_t version);
+
+/* Same as cache_fill, for a block read ahead of any request for it. The
+ * first cache_lookup to hit it counts as a prefetch hit; if it leaves the
+ * cache or is overwritten before that, the prefetch counts as wasted. */
+int cache_prefetch(int disk_num, int block_num, const uint8_t *buf, uint32_t version);
+
+/* Returns 1 on success and -1 on failure. Stores a new copy of the block,
+ * inserting it or updating the cached copy, and marks it dirty, as a single
+ * step so the copy cannot be evicted in between (see cache_mark_dirty). A
+ * cached copy that already holds exactly these bytes is left as it is. */
+int cache_write(int disk_num, int block_num, const uint8_t *buf);
+
 /* If the entry with |disk_num| and |block_num| exists, updates the
  * corresponding block with data from |buf| */
 void cache_update(int disk_num, int block_num, const uint8_t *buf);
 
+/* Returns 1 on success and -1 on failure. Like cache_lookup, but does not
+ * count towards the hit rate or count as a use for the eviction policy. */
+int cache_peek(int disk_num, int block_num, uint8_t *buf);
+
+/* Returns 1 on success and -1 if the block is not cached. Marks the entry for
+ * |disk_num| and |block_num| as dirty: it is newer than the JBOD's copy, and
+ * is passed to the writeback function (see below) before it is evicted. */
+int cache_mark_dirty(int disk_num, int block_num);
+
+/* Sets the function used to write dirty entries back to the JBOD. Without
+ * one, dirty entries cannot be evicted or flushed. */
+void cache_set_writeback(cache_writeback_t fn);
+
+/* Returns 1 on success and -1 on failure. Writes every dirty entry back in
+ * ascending (disk_num, block_num) order and marks it clean. */
+int cache_flush(void);
+
 /* Returns true if cache is enabled and false if not. */
 bool cache_enabled(void);
 
-/* Prints the hit rate of the cache. */
+/* Prints the hit rate of the cache, followed by the policy in use and its
+ * insert, eviction, ghost hit and write-back counts, and, if any blocks were
+ * prefetched, how many of them were hit and how many wasted. Lookups are
+ * counted in stats (STATS_CACHE_HITS and STATS_CACHE_MISSES). */
 void cache_print_hit_rate(void);
 
+/* Stores the number of hits and lookups since the cache was created in
+ * |num_hits| and |num_queries|, added up over every thread. */
+void cache_get_hits(int *num_hits, int *num_queries);
+
 /* Resizes the cache to |new_size| entries. If |new_size| is smaller than the
- * current size, evicts the most recently used entries. If |new_size| is
- * larger than the current size, allocates new entries and initializes them to
- * invalid. */
+ * current size, evicts entries chosen by the policy (the most recently used
+ * entries under MRU). If |new_size| is larger than the current size,
+ * allocates new entries and initializes them to invalid. */
 int cache_resize(int new_size);
 
 #endif
@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <err.h>
+#include <pthread.h>
+
+#include "cache.h"
+#include "jbod.h"
+#include "util.h"
+
+#define CACHE_BENCH_ARGUMENTS "hn:t:s:p:"
+#define USAGE                                                   \
+  "USAGE: cache_bench [-h] [-n lookups] [-t threads] [-s shards] [-p policy]\n" \
+  "\n"                                                          \
+  "where:\n"                                                    \
+  "    -h - help mode (display this message)\n"                 \
+  "    -n - number of timed lookups per cache size (per thread with -t)\n" \
+  "    -t - stress mode: look up (and insert on a miss) from 1, 2, 4, ... up to\n" \
+  "         this many threads at once on one shared cache\n"    \
+  "    -s - number of shards of the shared cache (default 16)\n" \
+  "    -p - policy of the shared cache: MRU, LRU, CLOCK (default), 2Q or ARC\n" \
+  "\n"                                                          \
+
+#define NUM_KEYS 65536
+
+//keys are drawn from a universe twice the size of the cache (capped at every block in the JBOD), so roughly half
+//of the lookups hit once the cache has been filled
+static void make_keys(int cache_size, int *disks, int *blocks){
+  int universe = cache_size * 2;
+  if(universe > JBOD_NUM_DISKS * JBOD_NUM_BLOCKS_PER_DISK){
+    universe = JBOD_NUM_DISKS * JBOD_NUM_BLOCKS_PER_DISK;
+  }
+  for(int i = 0; i < NUM_KEYS; i++){
+    int key = get_rand(0, universe - 1);
+    disks[i] = key / JBOD_NUM_BLOCKS_PER_DISK;
+    blocks[i] = key % JBOD_NUM_BLOCKS_PER_DISK;
+  }
+}
+
+static double now(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//stress mode: every thread runs the same key stream from its own starting point, inserting whatever misses, so the
+//shared cache sees lookups and the inserts and evictions they cause from all threads at once
+#define STRESS_ENTRIES 1024
+
+static int stress_disks[NUM_KEYS], stress_blocks[NUM_KEYS];
+static pthread_barrier_t stress_start;
+
+typedef struct {
+  int id;
+  long lookups;
+  long hits;
+} stress_thread_t;
+
+static void *stress_run(void *arg){
+  stress_thread_t *t = arg;
+  uint8_t buf[JBOD_BLOCK_SIZE];
+  memset(buf, t->id, JBOD_BLOCK_SIZE);
+
+  pthread_barrier_wait(&stress_start);
+  //the starting points are 1/64th of the stream apart, so beyond 64 threads they come round again
+  for (long i = 0, k = (t->id * (NUM_KEYS / 64)) % NUM_KEYS; i < t->lookups; ++i, k = (k + 1) % NUM_KEYS) {
+    if (cache_lookup(stress_disks[k], stress_blocks[k], buf) == 1)
+      ++t->hits;
+    else
+      cache_insert(stress_disks[k], stress_blocks[k], buf);
+  }
+  return NULL;
+}
+
+static void stress(int max_threads, long lookups, int shards, cache_policy_t policy){
+  make_keys(STRESS_ENTRIES, stress_disks, stress_blocks);
+  printf("%d entries, %s, %d shards\n", STRESS_ENTRIES, cache_policy_name(policy), shards);
+  printf("%8s %12s %10s %14s %18s\n", "threads", "lookups", "hits", "lookups/sec", "lookups/sec/thread");
+  for (int n = 1; n <= max_threads; n = n * 2 > max_threads && n < max_threads ? max_threads : n * 2) {
+    if (cache_create_sharded(STRESS_ENTRIES, policy, shards) != 1)
+      errx(1, "Failed to create cache of %d entries.", STRESS_ENTRIES);
+
+    stress_thread_t threads[n];
+    pthread_t tids[n];
+    pthread_barrier_init(&stress_start, NULL, n + 1);
+    for (int i = 0; i < n; ++i) {
+      threads[i] = (stress_thread_t){i, lookups, 0};
+      if (pthread_create(&tids[i], NULL, stress_run, &threads[i]))
+        errx(1, "Failed to start thread %d.", i);
+    }
+    pthread_barrier_wait(&stress_start);
+    double start = now();
+    long hits = 0;
+    for (int i = 0; i < n; ++i) {
+      pthread_join(tids[i], NULL);
+      hits += threads[i].hits;
+    }
+    double elapsed = now() - start;
+    pthread_barrier_destroy(&stress_start);
+
+    printf("%8d %12ld %10ld %14.0f %18.0f\n", n, n * lookups, hits, n * lookups / elapsed, lookups / elapsed);
+    cache_destroy();
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  int ch;
+  long lookups = 4000000;
+  int max_threads = 0, shards = 16;
+  cache_policy_t policy = CACHE_POLICY_CLOCK;
+
+  while ((ch = getopt(argc, argv, CACHE_BENCH_ARGUMENTS)) != -1) {
+    switch (ch) {
+      case 'h':
+        fprintf(stderr, USAGE);
+        return 0;
+      case 'n':
+        lookups = atol(optarg);
+        break;
+      case 't':
+        max_threads = atoi(optarg);
+        if (max_threads < 1)
+          errx(1, "Number of threads must be at least 1.");
+        break;
+      case 's':
+        shards = atoi(optarg);
+        if (shards < 1 || shards > CACHE_MAX_SHARDS)
+          errx(1, "Number of shards must be between 1 and %d.", CACHE_MAX_SHARDS);
+        break;
+      case 'p':
+        if (cache_policy_from_name(optarg) == -1)
+          errx(1, "Unknown cache policy %s.", optarg);
+        policy = cache_policy_from_name(optarg);
+        break;
+      default:
+        fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+        return -1;
+    }
+  }
+
+  if (max_threads > 0) {
+    stress(max_threads, lookups, shards, policy);
+    return 0;
+  }
+
+  static int disks[NUM_KEYS], blocks[NUM_KEYS];
+  uint8_t buf[JBOD_BLOCK_SIZE];
+  memset(buf, 0, JBOD_BLOCK_SIZE);
+
+  printf("%8s %12s %10s %14s\n", "entries", "lookups", "hits", "lookups/sec");
+  for (int size = 2; size <= 4096; size *= 2) {
+    make_keys(size, disks, blocks);
+    if (cache_create(size) != 1)
+      errx(1, "Failed to create cache of %d entries.", size);
+
+    //warm the cache with the same key stream so the timed loop measures steady state
+    for (int i = 0; i < NUM_KEYS; ++i)
+      if (cache_lookup(disks[i], blocks[i], buf) == -1)
+        cache_insert(disks[i], blocks[i], buf);
+
+    long hits = 0;
+    double start = now();
+    for (long i = 0; i < lookups; ++i)
+      if (cache_lookup(disks[i % NUM_KEYS], blocks[i % NUM_KEYS], buf) == 1)
+        ++hits;
+    double elapsed = now() - start;
+
+    printf("%8d %12ld %10ld %14.0f\n", size, lookups, hits, lookups / elapsed);
+    cache_destroy();
+  }
+
+  return 0;
+}
@@ -0,0 +1,479 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <err.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "jbod.h"
+#include "mux.h"
+#include "net.h"
+#include "util.h"
+
+#define SERVER_ARGUMENTS "hvp:t:"
+#define USAGE                                                    \
+  "USAGE: jbod_server [-h] [-v] [-p port] [-t threads] \n"       \
+  "\n"                                                           \
+  "where:\n"                                                     \
+  "    -h - help mode (display this message)\n"                  \
+  "    -v - verbose mode (log every command)\n"                  \
+  "    -p - port to listen on (default 3333)\n"                  \
+  "    -t - number of worker threads (default: one per CPU)\n"   \
+  "\n"                                                           \
+
+/* exported by jbod.o but not declared in jbod.h */
+void jbod_print_cost(void);
+
+int debug = 0;
+volatile sig_atomic_t done = 0;
+
+/* largest request and reply: a full JBOD_WRITE_N and a full JBOD_READ_N */
+#define MAX_PACKET_LEN (HEADER_LEN + JBOD_MAX_BATCH * (JBOD_BATCH_ADDR_LEN + JBOD_BLOCK_SIZE))
+/* a connection's input buffer always has room for one whole request, and its
+ * output buffer for a window's worth of replies */
+#define IN_BUF_LEN (2 * MAX_PACKET_LEN)
+#define OUT_BUF_LEN (16 * MAX_PACKET_LEN)
+#define MAX_EVENTS 64
+
+/* one client connection. only one worker handles a connection at a time (its
+ * socket is registered with EPOLLONESHOT), so none of this needs a lock, but
+ * for mux, its view of the JBOD, which is only touched under backend_lock */
+typedef struct conn {
+  int sd;
+  struct sockaddr_in addr;
+  uint8_t in[IN_BUF_LEN];
+  int in_len;
+  uint8_t out[OUT_BUF_LEN];
+  int out_len;
+  mux_client_t mux;
+  struct conn *next;
+} conn_t;
+
+/* the JBOD itself is shared by every connection, each of which sees it as if
+ * it were alone. jbod_operation is not thread-safe, so mux is protected by
+ * backend_lock */
+static pthread_mutex_t backend_lock = PTHREAD_MUTEX_INITIALIZER;
+static mux_t mux;
+
+/* connections with something to do, waiting for a worker */
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static conn_t *queue_head = NULL, *queue_tail = NULL;
+static bool stopping = false;
+
+static int epfd = -1;
+
+static const char *cmd_text[] = {
+  "JBOD_MOUNT",
+  "JBOD_UNMOUNT",
+  "JBOD_SEEK_TO_DISK",
+  "JBOD_SEEK_TO_BLOCK",
+  "JBOD_READ_BLOCK",
+  "JBOD_WRITE_PERMISSION",
+  "JBOD_REVOKE_WRITE_PERMISSION",
+  "JBOD_WRITE_BLOCK",
+  "JBOD_SIGN_BLOCK",
+};
+
+const char *cmd_str(uint8_t cmd) {
+  if (cmd == JBOD_READ_N)
+    return "JBOD_READ_N";
+  if (cmd == JBOD_WRITE_N)
+    return "JBOD_WRITE_N";
+  if (cmd >= JBOD_NUM_CMDS)
+    return "unknown command";
+  return cmd_text[cmd];
+}
+
+static char *stringify(const uint8_t *buf, int len) {
+  char *s = malloc(len * 6);
+  int n = 0;
+
+  for (int i = 0; i < len; ++i) {
+    if (i && i % 16 == 0)
+      n += sprintf(&s[n], "\n");
+    n += sprintf(&s[n], "0x%02x ", buf[i]);
+  }
+  return s;
+}
+
+/* runs one request from c. payload is whatever the client sent with it (NULL
+ * if nothing), and the reply payload (reply_len bytes) goes in reply. reads
+ * and signatures get their payload back even when they fail, as they do from
+ * the original server, so a client always knows how long the reply to each
+ * request is and can read it whole. returns 0 on success and -1 on failure,
+ * like jbod_operation */
+static int handle_request(conn_t *c, uint32_t op, uint8_t *payload, uint8_t *reply, int *reply_len) {
+  int cmd = (op >> 12) & 0x3f;
+  int count = op >> JBOD_BATCH_COUNT_SHIFT;
+  int rc = 0;
+
+  *reply_len = 0;
+  pthread_mutex_lock(&backend_lock);
+  switch (cmd) {
+    case JBOD_READ_N:
+    case JBOD_WRITE_N:
+      if (count > 0 && payload == NULL)
+        rc = -1;
+      for (int i = 0; i < count && rc == 0; ++i) {
+        int disk = payload[i * JBOD_BATCH_ADDR_LEN];
+        int block = payload[i * JBOD_BATCH_ADDR_LEN + 1];
+        if (cmd == JBOD_READ_N)
+          rc = mux_block(&mux, &c->mux, JBOD_READ_BLOCK, disk, block, &reply[i * JBOD_BLOCK_SIZE]);
+        else
+          rc = mux_block(&mux, &c->mux, JBOD_WRITE_BLOCK, disk, block,
+                         &payload[count * JBOD_BATCH_ADDR_LEN + i * JBOD_BLOCK_SIZE]);
+      }
+      if (cmd == JBOD_READ_N)
+        *reply_len = count * JBOD_BLOCK_SIZE;
+      break;
+
+    case JBOD_READ_BLOCK:
+    case JBOD_SIGN_BLOCK:
+      rc = mux_operation(&mux, &c->mux, op, reply);
+      *reply_len = JBOD_BLOCK_SIZE;
+      break;
+
+    default:
+      rc = mux_operation(&mux, &c->mux, op, payload);
+      break;
+  }
+  pthread_mutex_unlock(&backend_lock);
+
+  if (debug)
+    fprintf(stderr, "received cmd id = %d (%s) [disk id = %d block id = %d], result = %d\n",
+            cmd, cmd_str(cmd), op & 0xf, (op >> 4) & 0xff, rc);
+  if (debug && cmd == JBOD_WRITE_BLOCK && payload != NULL) {
+    char *s = stringify(payload, JBOD_BLOCK_SIZE);
+    fprintf(stderr, "block contents:\n%s\n", s);
+    free(s);
+  }
+  return rc;
+}
+
+/* how many payload bytes follow a request header carrying op */
+static int request_payload_len(uint32_t op) {
+  int cmd = (op >> 12) & 0x3f;
+  int count = op >> JBOD_BATCH_COUNT_SHIFT;
+
+  if (cmd == JBOD_READ_N)
+    return count * JBOD_BATCH_ADDR_LEN;
+  if (cmd == JBOD_WRITE_N)
+    return count * (JBOD_BATCH_ADDR_LEN + JBOD_BLOCK_SIZE);
+  return JBOD_BLOCK_SIZE;
+}
+
+/* runs every complete request in c's input buffer, as long as there is room
+ * for the replies. returns false if the client sent something malformed */
+static bool process_input(conn_t *c) {
+  int pos = 0;
+
+  while (c->in_len - pos >= (int)HEADER_LEN && OUT_BUF_LEN - c->out_len >= MAX_PACKET_LEN) {
+    uint8_t *header = &c->in[pos];
+    uint32_t op;
+    int len = 0;
+
+    memcpy(&op, header, sizeof(op));
+    op = ntohl(op);
+    if (op >> JBOD_BATCH_COUNT_SHIFT > JBOD_MAX_BATCH) {
+      fprintf(stderr, "client sent %u blocks in one command\n", op >> JBOD_BATCH_COUNT_SHIFT);
+      return false;
+    }
+    if (header[4] & 2)
+      len = request_payload_len(op);
+    if (c->in_len - pos < (int)HEADER_LEN + len)
+      break;
+    //the JBOD only writes into the reply, so requests are run straight out of the input buffer
+    uint8_t *payload = len > 0 ? &header[HEADER_LEN] : NULL;
+    pos += HEADER_LEN + len;
+
+    uint8_t *reply = &c->out[c->out_len];
+    int reply_len;
+    int rc = handle_request(c, op, payload, &reply[HEADER_LEN], &reply_len);
+    //a failed read leaves whatever an earlier reply put there; do not hand it back
+    if (rc == -1)
+      memset(&reply[HEADER_LEN], 0, reply_len);
+    uint32_t nop = htonl(op);
+    memcpy(reply, &nop, sizeof(nop));
+    reply[4] = (rc == -1 ? 1 : 0) | (reply_len > 0 ? 2 : 0);
+    c->out_len += HEADER_LEN + reply_len;
+  }
+
+  memmove(c->in, &c->in[pos], c->in_len - pos);
+  c->in_len -= pos;
+  return true;
+}
+
+/* writes as much of c's output buffer as the socket takes. returns false if
+ * the connection is broken */
+static bool flush_output(conn_t *c) {
+  int n = 0;
+
+  while (n < c->out_len) {
+    int rc = write(c->sd, &c->out[n], c->out_len - n);
+    if (rc == -1) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+      fprintf(stderr, "writing to client failed: %s\n", strerror(errno));
+      return false;
+    }
+    n += rc;
+  }
+  memmove(c->out, &c->out[n], c->out_len - n);
+  c->out_len -= n;
+  return true;
+}
+
+static void close_conn(conn_t *c) {
+  fprintf(stderr, "closing connection to %s port %d\n", inet_ntoa(c->addr.sin_addr), c->addr.sin_port);
+  epoll_ctl(epfd, EPOLL_CTL_DEL, c->sd, NULL);
+  close(c->sd);
+
+  //a client that goes away without cleaning up must not keep the JBOD mounted or writable for everyone else
+  pthread_mutex_lock(&backend_lock);
+  mux_release(&mux, &c->mux);
+  pthread_mutex_unlock(&backend_lock);
+  free(c);
+}
+
+/* hands c back to the event loop, waiting for it to become readable (or
+ * writable, while replies are still queued). c must not be touched afterwards:
+ * another worker may already have it */
+static void rearm(conn_t *c) {
+  struct epoll_event ev;
+
+  ev.events = (c->out_len > 0 ? EPOLLOUT : EPOLLIN) | EPOLLONESHOT;
+  ev.data.ptr = c;
+  epoll_ctl(epfd, EPOLL_CTL_MOD, c->sd, &ev);
+}
+
+/* does everything c's socket allows without blocking */
+static void serve(conn_t *c) {
+  for (;;) {
+    if (!process_input(c) || !flush_output(c)) {
+      close_conn(c);
+      return;
+    }
+    //stop reading while the client is not reading its replies
+    if (c->out_len > 0) {
+      rearm(c);
+      return;
+    }
+
+    //a full input buffer holds at least one whole request, which the output buffer now has room for
+    if (c->in_len == IN_BUF_LEN)
+      continue;
+
+    int rc = read(c->sd, &c->in[c->in_len], IN_BUF_LEN - c->in_len);
+    if (rc > 0) {
+      c->in_len += rc;
+      continue;
+    }
+    if (rc == 0) {
+      fprintf(stderr, "client closed connection\n");
+      close_conn(c);
+      return;
+    }
+    if (errno == EINTR)
+      continue;
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      rearm(c);
+      return;
+    }
+    fprintf(stderr, "reading from client failed: %s\n", strerror(errno));
+    close_conn(c);
+    return;
+  }
+}
+
+static void *worker(void *arg) {
+  for (;;) {
+    pthread_mutex_lock(&queue_lock);
+    while (queue_head == NULL && !stopping)
+      pthread_cond_wait(&queue_cond, &queue_lock);
+    if (queue_head == NULL) {
+      pthread_mutex_unlock(&queue_lock);
+      return NULL;
+    }
+    conn_t *c = queue_head;
+    queue_head = c->next;
+    if (queue_head == NULL)
+      queue_tail = NULL;
+    pthread_mutex_unlock(&queue_lock);
+
+    serve(c);
+  }
+}
+
+static void enqueue(conn_t *c) {
+  pthread_mutex_lock(&queue_lock);
+  c->next = NULL;
+  if (queue_tail)
+    queue_tail->next = c;
+  else
+    queue_head = c;
+  queue_tail = c;
+  pthread_cond_signal(&queue_cond);
+  pthread_mutex_unlock(&queue_lock);
+}
+
+static void accept_clients(int sd) {
+  int enable = 1;
+
+  for (;;) {
+    struct sockaddr_in caddr;
+    socklen_t caddr_len = sizeof(caddr);
+    int cli_sd = accept4(sd, (struct sockaddr *)&caddr, &caddr_len, SOCK_NONBLOCK);
+    if (cli_sd == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        return;
+      if (errno == ECONNABORTED || errno == EMFILE || errno == ENFILE) {
+        fprintf(stderr, "accept failed: %s\n", strerror(errno));
+        return;
+      }
+      err(1, "accept failed: %s", strerror(errno));
+    }
+    //replies to pipelined requests are small writes in a row, which Nagle's algorithm would hold back
+    setsockopt(cli_sd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+    conn_t *c = calloc(1, sizeof(*c));
+    if (c == NULL) {
+      close(cli_sd);
+      continue;
+    }
+    c->sd = cli_sd;
+    c->addr = caddr;
+    mux_client_init(&c->mux);
+    fprintf(stderr, "new client connection from %s port %d\n", inet_ntoa(caddr.sin_addr), caddr.sin_port);
+
+    struct epoll_event ev = {.events = EPOLLIN | EPOLLONESHOT, .data.ptr = c};
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, cli_sd, &ev) == -1) {
+      close(cli_sd);
+      free(c);
+    }
+  }
+}
+
+/* only sets done; the main loop sees it once epoll_wait is interrupted and
+ * does the printing and cleaning up, which a handler must not */
+static void signal_handler(int signo) {
+  assert(signo == SIGINT);
+  done = 1;
+}
+
+static void jbod_server(uint16_t port, int num_threads) {
+  struct sigaction sa = {0};
+  struct sockaddr_in saddr = {0};
+  int enable = 1;
+
+  sa.sa_handler = signal_handler;
+  sigaction(SIGINT, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+  mux_init(&mux, jbod_operation);
+
+  int sd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (sd == -1)
+    err(1, "Failed to create a socket: %s", strerror(errno));
+  if (setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)))
+    err(1, "setsockopt failed: %s", strerror(errno));
+
+  saddr.sin_family = AF_INET;
+  saddr.sin_port = htons(port);
+  saddr.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (bind(sd, (struct sockaddr *)&saddr, sizeof(saddr)) == -1)
+    err(1, "bind failed: %s", strerror(errno));
+  if (listen(sd, SOMAXCONN) == -1)
+    err(1, "listen failed: %s", strerror(errno));
+
+  epfd = epoll_create1(0);
+  if (epfd == -1)
+    err(1, "epoll_create1 failed: %s", strerror(errno));
+  struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, sd, &ev) == -1)
+    err(1, "epoll_ctl failed: %s", strerror(errno));
+
+  //SIGINT has to interrupt epoll_wait in this thread, so the workers never take it
+  sigset_t mask, old_mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGINT);
+  pthread_sigmask(SIG_BLOCK, &mask, &old_mask);
+  pthread_t threads[num_threads];
+  for (int i = 0; i < num_threads; ++i)
+    if (pthread_create(&threads[i], NULL, worker, NULL))
+      errx(1, "Failed to start worker thread %d", i);
+  pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+
+  fprintf(stderr, "JBOD server listening on port %d...\n", port);
+  while (!done) {
+    struct epoll_event events[MAX_EVENTS];
+    int n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      err(1, "epoll_wait failed: %s", strerror(errno));
+    }
+    for (int i = 0; i < n; ++i) {
+      if (events[i].data.ptr == NULL)
+        accept_clients(sd);
+      else
+        enqueue(events[i].data.ptr);
+    }
+  }
+
+  fprintf(stderr, "shutting down JBOD server...\n");
+  pthread_mutex_lock(&queue_lock);
+  stopping = true;
+  pthread_cond_broadcast(&queue_cond);
+  pthread_mutex_unlock(&queue_lock);
+  for (int i = 0; i < num_threads; ++i)
+    pthread_join(threads[i], NULL);
+  close(sd);
+  close(epfd);
+  //what every client cost the JBOD, now that none of them is left
+  jbod_print_cost();
+}
+
+int main(int argc, char *argv[]) {
+  int ch;
+  uint16_t port = JBOD_PORT;
+  int num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+  while ((ch = getopt(argc, argv, SERVER_ARGUMENTS)) != -1) {
+    switch (ch) {
+      case 'h':
+        fprintf(stderr, USAGE);
+        return 0;
+      case 'v':
+        debug = 1;
+        break;
+      case 'p':
+        port = atoi(optarg);
+        break;
+      case 't':
+        num_threads = atoi(optarg);
+        break;
+      default:
+        fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+        return -1;
+    }
+  }
+  if (num_threads < 1)
+    num_threads = 1;
+
+  jbod_server(port, num_threads);
+  return 0;
+}
@@ -0,0 +1,233 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "jbod.h"
+#include "local.h"
+#include "mux.h"
+#include "stats.h"
+#include "util.h"
+
+/* exported by jbod.o but not declared in jbod.h */
+void jbod_print_cost(void);
+
+#define IMAGE_SIZE (JBOD_NUM_DISKS * JBOD_DISK_SIZE)
+
+/* what the JBOD's disks are kept in. operation runs one single-block command
+ * and returns 0 on success and -1 on failure, like jbod_operation */
+typedef struct {
+  bool (*open)(const char *path);
+  void (*close)(void);
+  int (*operation)(uint32_t op, uint8_t *block);
+} device_ops_t;
+
+/* the JBOD is shared by every client in the process. jbod_operation is not
+ * thread-safe, so everything below is protected by local_lock, the way the
+ * server's backend_lock protects its JBOD */
+static pthread_mutex_t local_lock = PTHREAD_MUTEX_INITIALIZER;
+static const device_ops_t *device = NULL;
+static char *device_path = NULL;
+static int open_count = 0;
+static mux_t mux;
+
+/* what jbod_operation charges for each command, failed or not. jbod.o only
+ * prints its total, so the cost is counted here, for either device */
+static const int op_cost[JBOD_NUM_CMDS] = {
+    [JBOD_MOUNT] = 1000,       [JBOD_UNMOUNT] = 1000,    [JBOD_SEEK_TO_DISK] = 500,
+    [JBOD_SEEK_TO_BLOCK] = 50, [JBOD_READ_BLOCK] = 100, [JBOD_WRITE_BLOCK] = 200,
+};
+static long cost = 0;
+
+static bool memory_open(const char *path) {
+  return true;
+}
+
+static void memory_close(void) {
+  jbod_print_cost();
+}
+
+static const device_ops_t memory_device = {memory_open, memory_close, jbod_operation};
+
+/* the image device does what jbod_operation does, on the mapped file */
+static struct {
+  int fd;
+  uint8_t *disks;
+  bool mounted, write_permission;
+  int disk, block;
+} image = {.fd = -1};
+
+static bool image_open(const char *path) {
+  struct stat st;
+
+  image.fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (image.fd == -1)
+    return false;
+  //a new image (or one cut short) reads as zeroes past its end
+  if (fstat(image.fd, &st) == -1 || (st.st_size < IMAGE_SIZE && ftruncate(image.fd, IMAGE_SIZE) == -1)) {
+    close(image.fd);
+    image.fd = -1;
+    return false;
+  }
+  image.disks = mmap(NULL, IMAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, image.fd, 0);
+  if (image.disks == MAP_FAILED) {
+    close(image.fd);
+    image.fd = -1;
+    return false;
+  }
+  image.mounted = image.write_permission = false;
+  return true;
+}
+
+static void image_close(void) {
+  msync(image.disks, IMAGE_SIZE, MS_SYNC);
+  munmap(image.disks, IMAGE_SIZE);
+  close(image.fd);
+  image.fd = -1;
+}
+
+static int image_operation(uint32_t op, uint8_t *block) {
+  int cmd = (op >> 12) & 0x3f;
+  int disk = op & 0xf;
+  int blk = (op >> 4) & 0xff;
+  uint8_t *where;
+
+  if (cmd == JBOD_MOUNT) {
+    if (image.mounted)
+      return -1;
+    image.mounted = true;
+    image.disk = image.block = 0;
+    return 0;
+  }
+  if (!image.mounted)
+    return -1;
+
+  switch (cmd) {
+    case JBOD_UNMOUNT:
+      image.mounted = false;
+      //everything written so far is on the file once the JBOD is unmounted
+      return msync(image.disks, IMAGE_SIZE, MS_SYNC) == -1 ? -1 : 0;
+
+    case JBOD_WRITE_PERMISSION:
+    case JBOD_REVOKE_WRITE_PERMISSION:
+      if (image.write_permission == (cmd == JBOD_WRITE_PERMISSION))
+        return -1;
+      image.write_permission = cmd == JBOD_WRITE_PERMISSION;
+      return 0;
+
+    case JBOD_SEEK_TO_DISK:
+      image.disk = disk;
+      image.block = 0;
+      return 0;
+
+    case JBOD_SEEK_TO_BLOCK:
+      image.block = blk;
+      return 0;
+
+    case JBOD_READ_BLOCK:
+    case JBOD_WRITE_BLOCK:
+      if (image.block >= JBOD_NUM_BLOCKS_PER_DISK || block == NULL)
+        return -1;
+      if (cmd == JBOD_WRITE_BLOCK && !image.write_permission)
+        return -1;
+      where = &image.disks[image.disk * JBOD_DISK_SIZE + image.block++ * JBOD_BLOCK_SIZE];
+      if (cmd == JBOD_READ_BLOCK)
+        memcpy(block, where, JBOD_BLOCK_SIZE);
+      else
+        memcpy(where, block, JBOD_BLOCK_SIZE);
+      return 0;
+
+    case JBOD_SIGN_BLOCK:
+      if (block == NULL)
+        return -1;
+      where = &image.disks[disk * JBOD_DISK_SIZE + blk * JBOD_BLOCK_SIZE];
+      snprintf((char *)block, JBOD_BLOCK_SIZE, "SIG(disk,block) %2d %3d : %s\n", disk, blk,
+               sha1_sig(where, JBOD_BLOCK_SIZE));
+      return 0;
+
+    default:
+      return -1;
+  }
+}
+
+static const device_ops_t image_device = {image_open, image_close, image_operation};
+
+/* runs one single-block command on the device, counting what it costs.
+ * called with local_lock held */
+static int device_operation(uint32_t op, uint8_t *block) {
+  int cmd = (op >> 12) & 0x3f;
+
+  if (cmd < JBOD_NUM_CMDS)
+    cost += op_cost[cmd];
+  if (cmd == JBOD_SEEK_TO_DISK || cmd == JBOD_SEEK_TO_BLOCK)
+    stats_count(STATS_SEEKS_SENT);
+  return device->operation(op, block);
+}
+
+bool local_open(local_conn_t *c, const char *path) {
+  const device_ops_t *want = path != NULL ? &image_device : &memory_device;
+  bool ok = true;
+
+  pthread_mutex_lock(&local_lock);
+  if (open_count == 0) {
+    device_path = path != NULL ? strdup(path) : NULL;
+    cost = 0;
+    ok = (path == NULL || device_path != NULL) && want->open(path);
+    if (ok) {
+      device = want;
+      mux_init(&mux, device_operation);
+    } else {
+      free(device_path);
+      device_path = NULL;
+    }
+  } else {
+    ok = device == want && (path == NULL || strcmp(path, device_path) == 0);
+  }
+  if (ok) {
+    ++open_count;
+    mux_client_init(c);
+  }
+  pthread_mutex_unlock(&local_lock);
+  return ok;
+}
+
+void local_close(local_conn_t *c) {
+  pthread_mutex_lock(&local_lock);
+  //a client that goes away without cleaning up must not keep the JBOD mounted or writable for everyone else
+  mux_release(&mux, c);
+  if (--open_count == 0) {
+    device->close();
+    device = NULL;
+    free(device_path);
+    device_path = NULL;
+  }
+  pthread_mutex_unlock(&local_lock);
+}
+
+int local_operation(local_conn_t *c, uint32_t op, uint8_t *block) {
+  pthread_mutex_lock(&local_lock);
+  int rc = mux_operation(&mux, c, op, block);
+  pthread_mutex_unlock(&local_lock);
+  return rc == -1 ? -1 : 1;
+}
+
+long local_cost(void) {
+  pthread_mutex_lock(&local_lock);
+  long total = cost;
+  pthread_mutex_unlock(&local_lock);
+  return total;
+}
+
+int local_blocks(local_conn_t *c, int cmd, const jbod_block_addr_t *addrs, int count, uint8_t *buf) {
+  int rc = 0;
+
+  pthread_mutex_lock(&local_lock);
+  for (int i = 0; i < count && rc == 0; ++i)
+    rc = mux_block(&mux, c, cmd, addrs[i].disk, addrs[i].block, &buf[i * JBOD_BLOCK_SIZE]);
+  pthread_mutex_unlock(&local_lock);
+  return rc == -1 ? -1 : 1;
+}
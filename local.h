@@ -0,0 +1,41 @@
+#ifndef LOCAL_H_
+#define LOCAL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mux.h"
+#include "net.h"
+
+/* the JBOD inside this process, for clients that skip jbod_server. it is
+ * either the disks jbod_operation keeps in memory, or an image file mapped
+ * into memory (JBOD_NUM_DISKS * JBOD_DISK_SIZE bytes), which is synced to
+ * disk on every unmount and survives the process. it is shared by every
+ * client in the process, and each one sees it the way a connection sees the
+ * server, through the same mux */
+typedef mux_client_t local_conn_t;
+
+/* Opens the JBOD for one more client, backed by the image at |path|, created
+ * if it does not exist, or by jbod_operation if |path| is NULL. Returns false
+ * if it cannot be opened, or is already open with a different backing. */
+bool local_open(local_conn_t *c, const char *path);
+
+/* Drops c's mount and write permission, and closes the JBOD once the last
+ * client has, syncing the image (or printing jbod_operation's cost). */
+void local_close(local_conn_t *c);
+
+/* Runs one single-block operation for c, like jbod_operation; returns 1 on
+ * success and -1 on failure. */
+int local_operation(local_conn_t *c, uint32_t op, uint8_t *block);
+
+/* Returns what the commands run on the JBOD since it was opened would have
+ * cost on the real one: the cost jbod_operation charges, which the image
+ * device is charged too. */
+long local_cost(void);
+
+/* Reads (JBOD_READ_BLOCK) or writes (JBOD_WRITE_BLOCK) the count blocks at
+ * addrs, like a JBOD_READ_N or JBOD_WRITE_N; returns 1 on success and -1 on
+ * failure. */
+int local_blocks(local_conn_t *c, int cmd, const jbod_block_addr_t *addrs, int count, uint8_t *buf);
+
+#endif
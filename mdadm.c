@@ -1,18 +1,57 @@
 #include <assert.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <time.h>
 
 #include "cache.h"
 #include "jbod.h"
 #include "mdadm.h"
 //keep this include below? wasn't included in repo I wrote it
 #include "net.h"
+#include "stats.h"
+#include "util.h"
 
-int mounted = 0;
-int has_write_permission = 0;
+//the array's state, shared by every context. it only changes in mdadm_mount, mdadm_unmount, mdadm_set_write_back and
+//the permission calls, which must not race with reads and writes
+static int mounted = 0;
+static int has_write_permission = 0;
+//when set, mdadm_write only updates the cache and dirty blocks reach the JBOD when they are evicted or flushed
+static int write_back = 0;
+//the most blocks a sequential reader has read ahead of it into the cache, or 0 for no readahead
+static int readahead_max = 0;
+//how the array's blocks are laid out over the disks, set by mdadm_set_layout while unmounted
+static mdadm_layout_t layout = MDADM_LAYOUT_LINEAR;
+static int chunk_blocks = MDADM_DEFAULT_CHUNK_BLOCKS;
+
+static const char *layout_names[MDADM_NUM_LAYOUTS] = {"linear", "raid0", "raid10"};
+//whether blocks are checksummed (see mdadm_set_integrity), and the file the checksums are kept in, if any
+static int integrity = 0;
+static char *integrity_path = NULL;
+
+//a context is a client of its own, so threads each holding one talk to the server in parallel. lock is only ever
+//contended when a mount or permission change is sent on every context's connections
+struct mdadm_ctx {
+  pthread_mutex_t lock;
+  jbod_client_t *client;
+  struct mdadm_ctx *next;
+};
+
+//every open context. jbod_server_mt keeps mounts and write permission per connection, so those are sent on each of
+//them
+static pthread_mutex_t ctx_lock = PTHREAD_MUTEX_INITIALIZER;
+static mdadm_ctx_t *ctx_list = NULL;
+
+//writers lock the blocks they change for the whole read-modify-write, so two writes to different bytes of one block
+//cannot lose either update. the array's block lbn (address / JBOD_BLOCK_SIZE) uses stripe lbn % MDADM_LOCK_STRIPES
+#define MDADM_LOCK_STRIPES 64
+//one key per block of the JBOD, disk * JBOD_NUM_BLOCKS_PER_DISK + block
+#define MDADM_NUM_KEYS (JBOD_NUM_DISKS * JBOD_NUM_BLOCKS_PER_DISK)
+static pthread_mutex_t block_locks[MDADM_LOCK_STRIPES] = {[0 ... MDADM_LOCK_STRIPES - 1] = PTHREAD_MUTEX_INITIALIZER};
 
 //function to build uint32_t op to pass to jbod_operation
 uint32_t buildOperation(uint32_t diskID, uint32_t blockID, uint32_t command){
@@ -28,32 +67,333 @@ uint32_t buildOperation(uint32_t diskID, uint32_t blockID, uint32_t command){
   return retval;
 }
 
+//helper function to get the number of disks holding distinct data: RAID-10 keeps a second copy of the first half of
+//the disks on the second half
+static int dataDisks(void){
+  return layout == MDADM_LAYOUT_RAID10 ? JBOD_NUM_DISKS / 2 : JBOD_NUM_DISKS;
+}
+
+//helper function to get the number of bytes the array holds under the current layout
+static uint32_t arraySize(void){
+  return dataDisks() * JBOD_DISK_SIZE;
+}
+
+//helper function to map the array's block lbn (its address / JBOD_BLOCK_SIZE) to the disk and block holding it. linear
+//fills each disk before moving on to the next; the striped layouts deal the array out chunk_blocks blocks at a time to
+//each data disk in turn, so consecutive chunks sit on different disks. under RAID-10 this is the primary copy
+static jbod_block_addr_t mapBlock(uint32_t lbn){
+  jbod_block_addr_t where;
+  if(layout == MDADM_LAYOUT_LINEAR){
+    where.disk = lbn / JBOD_NUM_BLOCKS_PER_DISK;
+    where.block = lbn % JBOD_NUM_BLOCKS_PER_DISK;
+    return where;
+  }
+  uint32_t stripe = lbn / chunk_blocks;
+  where.disk = stripe % dataDisks();
+  where.block = stripe / dataDisks() * chunk_blocks + lbn % chunk_blocks;
+  return where;
+}
+
+//helper function to get the RAID-10 mirror of a primary copy
+static jbod_block_addr_t mirrorOf(jbod_block_addr_t where){
+  where.disk += JBOD_NUM_DISKS / 2;
+  return where;
+}
+
+//helper function to get the copy a block is read from. under RAID-10 every other row of chunks is read from the
+//mirrors, so a sequential read keeps every disk busy
+static jbod_block_addr_t readCopy(jbod_block_addr_t where){
+  if(layout == MDADM_LAYOUT_RAID10 && where.block / chunk_blocks % 2 == 1){
+    return mirrorOf(where);
+  }
+  return where;
+}
+
+//helper function to get the primary copy of a block read from either copy, which is what the cache knows it by
+static jbod_block_addr_t primaryOf(jbod_block_addr_t where){
+  if(layout == MDADM_LAYOUT_RAID10 && where.disk >= JBOD_NUM_DISKS / 2){
+    where.disk -= JBOD_NUM_DISKS / 2;
+  }
+  return where;
+}
+
+//helper function to map the primary copy of a block back to the array's block lbn, the inverse of mapBlock
+static uint32_t lbnOf(jbod_block_addr_t where){
+  if(layout == MDADM_LAYOUT_LINEAR){
+    return where.disk * JBOD_NUM_BLOCKS_PER_DISK + where.block;
+  }
+  uint32_t stripe = where.block / chunk_blocks * dataDisks() + where.disk;
+  return stripe * chunk_blocks + where.block % chunk_blocks;
+}
+
 //helper functions to find current disk and current block given start address
 int getCurrentDisk(int addr){
-  return addr / JBOD_DISK_SIZE;
+  return mapBlock(addr / JBOD_BLOCK_SIZE).disk;
 }
 int getCurrentBlock(int addr){
-  return (addr % JBOD_DISK_SIZE) / JBOD_BLOCK_SIZE;
+  return mapBlock(addr / JBOD_BLOCK_SIZE).block;
+}
+
+//helper function to point the JBOD's I/O position at a block. the client tracks where the server's head is and only
+//sends the seeks that actually move it, so this is cheap to call before every read or write
+void seekTo(int disk, int block){
+  jbod_client_operation(buildOperation(disk, 0, JBOD_SEEK_TO_DISK), NULL);
+  jbod_client_operation(buildOperation(0, block, JBOD_SEEK_TO_BLOCK), NULL);
 }
 
 //helper function to get the number of blocks needed spanned by a start address and length
 int numBlocksCovered(int addr, int length){
   int end_addr = addr + length - 1;
-  int current_disk = getCurrentDisk(addr);
-  int current_block = getCurrentBlock(addr);
-  int future_disk = getCurrentDisk(end_addr);
-  int future_block = getCurrentBlock(end_addr);
 
-  return ((future_disk * JBOD_NUM_BLOCKS_PER_DISK) + future_block) - ((current_disk * JBOD_NUM_BLOCKS_PER_DISK) + current_block) + 1;
+  return end_addr / JBOD_BLOCK_SIZE - addr / JBOD_BLOCK_SIZE + 1;
 
 }
 
-int mdadm_mount(void) {
+//helper function to send a mount or permission operation on the default client and then on every context's, since the
+//server keeps that state per connection. returns what the default client's operation returned
+static int broadcast_operation(uint32_t op){
+  jbod_client_t *old = jbod_client_bind(NULL);
+  int rc = jbod_client_operation(op, NULL);
+  pthread_mutex_lock(&ctx_lock);
+  for(mdadm_ctx_t *ctx = ctx_list; ctx != NULL; ctx = ctx->next){
+    pthread_mutex_lock(&ctx->lock);
+    jbod_client_bind(ctx->client);
+    jbod_client_operation(op, NULL);
+    pthread_mutex_unlock(&ctx->lock);
+  }
+  pthread_mutex_unlock(&ctx_lock);
+  jbod_client_bind(old);
+  return rc;
+}
+
+//helper function to lock or unlock the stripes with taken[k] set. stripes are always taken in ascending order so two
+//writers cannot deadlock
+static void lock_stripes(const bool *taken, bool lock){
+  for(int k = 0; k < MDADM_LOCK_STRIPES; k++){
+    if(taken[k] && lock){
+      pthread_mutex_lock(&block_locks[k]);
+    }
+    else if(taken[k]){
+      pthread_mutex_unlock(&block_locks[k]);
+    }
+  }
+}
+
+//helper function to lock or unlock the stripes of count consecutive blocks of the array starting at block first
+static void lock_blocks(uint32_t first, int count, bool lock){
+  bool taken[MDADM_LOCK_STRIPES] = {false};
+  for(int i = 0; i < count; i++){
+    taken[(first + i) % MDADM_LOCK_STRIPES] = true;
+  }
+  lock_stripes(taken, lock);
+}
+
+//integrity mode (see mdadm_set_integrity). block_crc holds the CRC32C of every block, by the key of its primary copy,
+//as it was last written to the JBOD or, if it has not been written since the table was started, as it was first read.
+//a write that is still only in the cache (write-back) or still pending (coalescing) leaves it alone until it is out.
+//crc_known marks the blocks the table has a checksum for, and only ever goes from 0 to 1 until the next mount. both
+//only change under the block's stripe lock (or, for a write-back, its cache shard's lock), but are read without it on
+//the fast path
+#define MDADM_INTEGRITY_MAGIC "MDCRC32C"
+
+static uint32_t block_crc[MDADM_NUM_KEYS];
+static uint8_t crc_known[MDADM_NUM_KEYS];
+//blocks read from the server and checked, how many of those the table had no checksum for, and how many were corrupt
+static long blocks_checked = 0;
+static long blocks_learned = 0;
+static long blocks_corrupt = 0;
+
+//helper function to get the key of the primary copy of the block at where (either copy)
+static uint32_t integrityKey(jbod_block_addr_t where){
+  where = primaryOf(where);
+  return where.disk * JBOD_NUM_BLOCKS_PER_DISK + where.block;
+}
+
+//helper function to start the table for a mount: from integrity_path if it holds one, empty otherwise
+static void integrity_load(void){
+  memset(crc_known, 0, sizeof(crc_known));
+  blocks_checked = blocks_learned = blocks_corrupt = 0;
+  if(integrity_path == NULL){
+    return;
+  }
+  FILE *f = fopen(integrity_path, "rb");
+  if(f == NULL){
+    return;
+  }
+  char magic[sizeof(MDADM_INTEGRITY_MAGIC) - 1];
+  bool ok = fread(magic, sizeof(magic), 1, f) == 1 && memcmp(magic, MDADM_INTEGRITY_MAGIC, sizeof(magic)) == 0 &&
+            fread(crc_known, sizeof(crc_known), 1, f) == 1 && fread(block_crc, sizeof(block_crc), 1, f) == 1;
+  fclose(f);
+  //a table that was cut short, or is not a table at all, is as good as none
+  if(!ok){
+    memset(crc_known, 0, sizeof(crc_known));
+  }
+}
+
+//helper function to save the table to integrity_path. it is written to a temporary file that then replaces the old
+//table, so a crash part way through leaves the old one whole
+static int integrity_save(void){
+  if(!integrity || integrity_path == NULL){
+    return 1;
+  }
+  size_t len = strlen(integrity_path) + sizeof(".tmp");
+  char *tmp = malloc(len);
+  if(tmp == NULL){
+    return -1;
+  }
+  snprintf(tmp, len, "%s.tmp", integrity_path);
+  FILE *f = fopen(tmp, "wb");
+  bool ok = f != NULL && fwrite(MDADM_INTEGRITY_MAGIC, sizeof(MDADM_INTEGRITY_MAGIC) - 1, 1, f) == 1 &&
+            fwrite(crc_known, sizeof(crc_known), 1, f) == 1 && fwrite(block_crc, sizeof(block_crc), 1, f) == 1;
+  if(f != NULL && fclose(f) != 0){
+    ok = false;
+  }
+  if(ok && rename(tmp, integrity_path) != 0){
+    ok = false;
+  }
+  if(!ok){
+    remove(tmp);
+  }
+  free(tmp);
+  return ok ? 1 : -1;
+}
+
+//helper function to record the new contents of the block at where (either copy), once they are on the JBOD. the
+//caller holds its stripe lock or, when a dirty block is written back, the lock of its cache shard
+static void integrity_note(jbod_block_addr_t where, const uint8_t *block){
+  uint32_t key = integrityKey(where);
+  __atomic_store_n(&block_crc[key], crc32c(block, JBOD_BLOCK_SIZE), __ATOMIC_RELAXED);
+  __atomic_store_n(&crc_known[key], 1, __ATOMIC_RELEASE);
+}
+
+//helper function to check a block just read from the server at where against the table, learning its checksum if
+//the table has none yet. with locked set the caller holds the block's stripe lock. otherwise a mismatch may only mean
+//a write landed between the read and the check, so the block is looked for again under the lock: a cached copy is as
+//new as the JBOD's (newer while it is dirty) and is kept as it is, otherwise the block is read again and the fresh
+//copy is checked, and kept, instead. returns 1 if the block is good, 0 if it is corrupt and -1 if it could not be read
+//again
+static int integrity_check(jbod_block_addr_t where, uint8_t *block, bool locked){
+  uint32_t key = integrityKey(where);
+  uint32_t crc = crc32c(block, JBOD_BLOCK_SIZE);
+  if(__atomic_load_n(&crc_known[key], __ATOMIC_ACQUIRE) && __atomic_load_n(&block_crc[key], __ATOMIC_RELAXED) == crc){
+    return 1;
+  }
+
+  uint32_t lbn = lbnOf(primaryOf(where));
+  if(!locked){
+    lock_blocks(lbn, 1, true);
+  }
+  int rc = 1;
+  //looking in the cache also waits out a write-back of the block that is under way, which holds the cache's lock
+  //rather than the stripe's, and none can start while the stripe is held since only writers make blocks dirty. a
+  //caller that holds the lock has looked already
+  if(!locked && cache_peek(where.disk, where.block, block) == 1){
+    rc = 1;
+  }
+  //every write that reaches the JBOD sets crc_known, so while it is still clear nothing has changed the block there
+  //since the table was started
+  else if(!crc_known[key]){
+    block_crc[key] = crc;
+    __atomic_store_n(&crc_known[key], 1, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&blocks_learned, 1, __ATOMIC_RELAXED);
+  }
+  else if(block_crc[key] != crc){
+    rc = 0;
+    uint8_t fresh[JBOD_BLOCK_SIZE];
+    if(!locked && (rc = jbod_client_read_blocks(&where, 1, fresh)) == 1){
+      rc = crc32c(fresh, JBOD_BLOCK_SIZE) == block_crc[key];
+      if(rc == 1){
+        memcpy(block, fresh, JBOD_BLOCK_SIZE);
+      }
+    }
+  }
+  if(!locked){
+    lock_blocks(lbn, 1, false);
+  }
+  if(rc == 0){
+    __atomic_fetch_add(&blocks_corrupt, 1, __ATOMIC_RELAXED);
+  }
+  return rc;
+}
+
+int mdadm_set_integrity(int enable, const char *table_path){
+  //the table describes what is on the disks, so it can only be swapped while nothing is reading or writing them
+  if(mounted){
+    return -1;
+  }
+  char *path = NULL;
+  if(enable && table_path != NULL && (path = strdup(table_path)) == NULL){
+    return -1;
+  }
+  free(integrity_path);
+  integrity_path = path;
+  integrity = enable;
+  return 1;
+}
+
+void mdadm_print_integrity_stats(void){
+  if(integrity){
+    fprintf(stderr, "Integrity: blocks checked: %ld, learned: %ld, corrupt: %ld\n", blocks_checked, blocks_learned,
+            blocks_corrupt);
+  }
+}
+
+mdadm_ctx_t *mdadm_ctx_open(const char *ip, uint16_t port){
+  mdadm_ctx_t *ctx = malloc(sizeof(*ctx));
+  if(ctx == NULL){
+    return NULL;
+  }
+  ctx->client = jbod_client_open(ip, port);
+  if(ctx->client == NULL){
+    free(ctx);
+    return NULL;
+  }
+  pthread_mutex_init(&ctx->lock, NULL);
+
+  //catch the new connections up with the array, under ctx_lock so a mount or permission change cannot slip by
+  pthread_mutex_lock(&ctx_lock);
+  jbod_client_t *old = jbod_client_bind(ctx->client);
+  if(mounted){
+    jbod_client_operation(buildOperation(0, 0, JBOD_MOUNT), NULL);
+  }
+  if(has_write_permission){
+    jbod_client_operation(buildOperation(0, 0, JBOD_WRITE_PERMISSION), NULL);
+  }
+  jbod_client_bind(old);
+  ctx->next = ctx_list;
+  ctx_list = ctx;
+  pthread_mutex_unlock(&ctx_lock);
+  return ctx;
+}
+
+void mdadm_ctx_close(mdadm_ctx_t *ctx){
+  if(ctx == NULL){
+    return;
+  }
+  pthread_mutex_lock(&ctx_lock);
+  for(mdadm_ctx_t **p = &ctx_list; *p != NULL; p = &(*p)->next){
+    if(*p == ctx){
+      *p = ctx->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&ctx_lock);
+  //the server drops the connections' mount and write permission when they close
+  jbod_client_close(ctx->client);
+  pthread_mutex_destroy(&ctx->lock);
+  free(ctx);
+}
+
+//mdadm_mount and mdadm_unmount time these
+static int mount_array(void) {
 	if(mounted){
     return -1;
   }
 
-  jbod_client_operation(buildOperation(0, 0, JBOD_MOUNT), NULL);
+  if(integrity){
+    integrity_load();
+  }
+  broadcast_operation(buildOperation(0, 0, JBOD_MOUNT));
   mounted = 1;
   return 1;
 
@@ -66,19 +406,117 @@ int mdadm_mount(void) {
   */
 }
 
-int mdadm_unmount(void) {
+static int unmount_array(void) {
   if(!mounted){
     return -1;
   }
-  if(jbod_client_operation(buildOperation(0, 0, JBOD_UNMOUNT), NULL) == 0){
-    mounted = 1;
+  //dirty blocks have to reach the JBOD while it is still mounted
+  if(mdadm_flush() == -1){
+    return -1;
+  }
+  //and the checksums of what was written have to be saved for the next mount to check against
+  if(integrity_save() == -1){
+    return -1;
+  }
+  //an unmount the JBOD refused leaves the array mounted, so the caller can try again
+  if(broadcast_operation(buildOperation(0, 0, JBOD_UNMOUNT)) == 1){
+    mounted = 0;
     return 1;
   }
   return -1;
 }
 
+int mdadm_mount(void) {
+  uint64_t start = stats_clock();
+  int rc = mount_array();
+  stats_time(STATS_MOUNT, start);
+  return rc;
+}
+
+int mdadm_unmount(void) {
+  uint64_t start = stats_clock();
+  int rc = unmount_array();
+  stats_time(STATS_UNMOUNT, start);
+  return rc;
+}
+
+//writeback function handed to the cache: seeks to the block and writes the dirty copy to the JBOD (and to its mirror
+//under RAID-10). in integrity mode its checksum is recorded once it is there
+static int write_back_block(int disk_num, int block_num, const uint8_t *buf){
+  uint8_t block[JBOD_BLOCK_SIZE];
+  memcpy(block, buf, JBOD_BLOCK_SIZE);
+  seekTo(disk_num, block_num);
+  int rc = jbod_client_operation(buildOperation(0, 0, JBOD_WRITE_BLOCK), block);
+  if(rc == 1 && integrity){
+    jbod_block_addr_t where = {disk_num, block_num};
+    integrity_note(where, block);
+  }
+  if(rc == 1 && layout == MDADM_LAYOUT_RAID10){
+    seekTo(disk_num + JBOD_NUM_DISKS / 2, block_num);
+    rc = jbod_client_operation(buildOperation(0, 0, JBOD_WRITE_BLOCK), block);
+  }
+  return rc;
+}
+
+//helper function for write-back mode: puts the new contents of a block in the cache and marks them dirty. returns
+//false if the block could not be cached (no cache, or a dirty victim could not be written back)
+static bool cache_write_back(int disk_num, int block_num, const uint8_t *buf){
+  return cache_enabled() && cache_write(disk_num, block_num, buf) == 1;
+}
+
+int mdadm_set_write_back(int enable){
+  //going back to write-through, so nothing may stay dirty
+  if(!enable && write_back && mdadm_flush() == -1){
+    return -1;
+  }
+  write_back = enable;
+  cache_set_writeback(write_back_block);
+  return 1;
+}
+
+int mdadm_set_layout(mdadm_layout_t new_layout, int new_chunk_blocks){
+  //the layout decides where every block lives, so it cannot change under a mounted array
+  if(mounted){
+    return -1;
+  }
+  if(new_layout < 0 || new_layout >= MDADM_NUM_LAYOUTS){
+    return -1;
+  }
+  //chunks have to tile a disk exactly
+  if(new_chunk_blocks < 1 || new_chunk_blocks > JBOD_NUM_BLOCKS_PER_DISK || (new_chunk_blocks & (new_chunk_blocks - 1)) != 0){
+    return -1;
+  }
+  layout = new_layout;
+  chunk_blocks = new_chunk_blocks;
+  return 1;
+}
+
+const char *mdadm_layout_name(mdadm_layout_t l){
+  if(l < 0 || l >= MDADM_NUM_LAYOUTS){
+    return "unknown";
+  }
+  return layout_names[l];
+}
+
+int mdadm_layout_from_name(const char *name){
+  for(int l = 0; l < MDADM_NUM_LAYOUTS; l++){
+    if(strcasecmp(name, layout_names[l]) == 0){
+      return l;
+    }
+  }
+  return -1;
+}
+
+int mdadm_set_readahead(int max_blocks){
+  if(max_blocks < 0 || max_blocks > JBOD_MAX_BATCH){
+    return -1;
+  }
+  readahead_max = max_blocks;
+  return 1;
+}
+
 int mdadm_write_permission(void){
-  jbod_client_operation(buildOperation(0, 0, JBOD_WRITE_PERMISSION), NULL);
+  broadcast_operation(buildOperation(0, 0, JBOD_WRITE_PERMISSION));
   has_write_permission = 1;
   return 1;
   /*if(jbod_client_operation(buildOperation(0, 0, JBOD_WRITE_PERMISSION), NULL) == 1){
@@ -93,7 +531,11 @@ int mdadm_revoke_write_permission(void){
   if(!has_write_permission){
     return -1;
   }
-  if(jbod_client_operation(buildOperation(0, 0, JBOD_REVOKE_WRITE_PERMISSION), NULL) == 1){
+  //dirty blocks can no longer be written once permission is gone
+  if(mdadm_flush() == -1){
+    return -1;
+  }
+  if(broadcast_operation(buildOperation(0, 0, JBOD_REVOKE_WRITE_PERMISSION)) == 1){
     has_write_permission = 0;
     return 1;
   }
@@ -101,59 +543,550 @@ int mdadm_revoke_write_permission(void){
 }
 
 
-int mdadm_read(uint32_t addr, uint32_t len, uint8_t *buf) {
-  //check to make sure mounted, read_len doesn't exceed 1024 bytes, and won't read beyond valid address space
-  if(!mounted){
-    return -3;
+//large reads and writes are streamed through the server MDADM_CHUNK_BLOCKS blocks at a time, the most one batched
+//request carries, so a transfer of any size only ever needs this much buffer space. each thread reuses its own
+#define MDADM_CHUNK_BLOCKS JBOD_MAX_BATCH
+
+//the write-combining stage (see mdadm_set_write_coalescing). while it is on, writes only merge their bytes into the
+//pending block table, whose blocks each remember which of their bytes have been written (mask) and what was written.
+//the table holds at most one batch, so it always goes out as one request. reads lay whatever is pending for their
+//blocks over what they read, and pending_index maps a block key to its slot, or -1
+#define MDADM_MAX_PENDING JBOD_MAX_BATCH
+
+typedef struct {
+  uint16_t key;
+  uint8_t mask[JBOD_BLOCK_SIZE / 8];
+  uint8_t data[JBOD_BLOCK_SIZE];
+} pending_block_t;
+
+static int coalesce_threshold = 0;
+static int coalesce_max_age_ms = 0;
+static pthread_mutex_t pending_lock = PTHREAD_MUTEX_INITIALIZER;
+static pending_block_t pending[MDADM_MAX_PENDING];
+//read without pending_lock to skip the lock when nothing is pending
+static int num_pending = 0;
+static int16_t pending_index[MDADM_NUM_KEYS] = {[0 ... MDADM_NUM_KEYS - 1] = -1};
+//bumped, with pending_lock held, by every flush before it writes anything out, so a read can tell whether the
+//pending blocks it took may have reached the cache or the server (and been written over again) while it read them
+static unsigned pending_generation = 0;
+//when the oldest pending write arrived
+static struct timespec pending_since;
+//block writes asked for while coalescing, and how many of them reached the cache or the server
+static long block_writes_requested = 0;
+static long block_writes_issued = 0;
+
+struct io_scratch {
+  //the chunk's blocks, in order
+  uint8_t blocks[MDADM_CHUNK_BLOCKS * JBOD_BLOCK_SIZE];
+  jbod_block_addr_t addrs[MDADM_CHUNK_BLOCKS];
+  //the blocks that go to the server in one request, and where each sits in the chunk
+  jbod_block_addr_t batch[MDADM_CHUNK_BLOCKS];
+  int batch_index[MDADM_CHUNK_BLOCKS];
+  uint8_t batch_data[MDADM_CHUNK_BLOCKS * JBOD_BLOCK_SIZE];
+  uint32_t versions[MDADM_CHUNK_BLOCKS];
+  //which blocks of the last batch read failed their integrity check
+  bool corrupt[MDADM_CHUNK_BLOCKS];
+  //which blocks a write needs the old contents of
+  bool need[MDADM_CHUNK_BLOCKS];
+  //what was pending for each of a read's blocks when it started
+  pending_block_t overlay[MDADM_CHUNK_BLOCKS];
+  bool has_overlay[MDADM_CHUNK_BLOCKS];
+  //pending_generation when they were taken
+  unsigned overlay_generation;
+};
+static __thread struct io_scratch scratch;
+
+//a thread's sequential stream, tracked like the kernel's readahead state. a read that starts in the block where the
+//thread's previous read ended, or the one after, continues the stream; anything else ends it. while a stream goes on
+//blocks up to frontier have been read ahead, and once the reader gets within half a window of it the next window,
+//twice as large as the last (up to readahead_max), is fetched along with the read, so the reader keeps hitting
+#define MDADM_READAHEAD_INITIAL 4
+
+struct readahead {
+  uint32_t next;
+  uint32_t frontier;
+  int window;
+};
+static __thread struct readahead ra;
+
+//helper function to feed a read of blocks [first, end) of the array to the calling thread's stream. returns how many
+//blocks from *start on should be read ahead, or 0 for none. these are logical block numbers, which fetch_chunk maps
+//to a disk and block through mapBlock, so a stream stays sequential across disks and under any layout
+static int readahead_plan(uint32_t first, uint32_t end, uint32_t *start){
+  bool sequential = first == ra.next || first + 1 == ra.next;
+  ra.next = end;
+  if(readahead_max == 0 || !cache_enabled() || !sequential){
+    ra.window = 0;
+    ra.frontier = end;
+    return 0;
   }
-  if(len > 1024){
-    return -2;
+  if(ra.window == 0){
+    ra.window = readahead_max < MDADM_READAHEAD_INITIAL ? readahead_max : MDADM_READAHEAD_INITIAL;
   }
-  if(addr + len > JBOD_NUM_DISKS * JBOD_DISK_SIZE){
+  else if((int)(ra.frontier - end) > ra.window / 2){
+    return 0;
+  }
+  else{
+    ra.window = 2 * ra.window < readahead_max ? 2 * ra.window : readahead_max;
+  }
+  *start = ra.frontier > end ? ra.frontier : end;
+  uint32_t num_blocks = arraySize() / JBOD_BLOCK_SIZE;
+  return *start + ra.window <= num_blocks ? ra.window : (int)(num_blocks - *start);
+}
+
+//helper function to get the length of the first chunk of a transfer: up to the end of the MDADM_CHUNK_BLOCKS-th block
+//it touches, or the end of the transfer if that comes first
+static uint32_t chunkLength(uint32_t addr, uint32_t len){
+  uint32_t chunk_end = (addr / JBOD_BLOCK_SIZE + MDADM_CHUNK_BLOCKS) * JBOD_BLOCK_SIZE;
+  return chunk_end - addr < len ? chunk_end - addr : len;
+}
+
+//helper function to read the count blocks at addrs from the server into buf in one request, checking each of them in
+//integrity mode and setting scratch.corrupt for the ones that fail (see integrity_check for locked). returns 1 on
+//success, -1 if the read fails and -6 if any block is corrupt
+static int read_verified(const jbod_block_addr_t *addrs, int count, uint8_t *buf, bool locked){
+  struct io_scratch *s = &scratch;
+  if(jbod_client_read_blocks(addrs, count, buf) == -1){
     return -1;
   }
-  if(buf == NULL && len != 0){
-    return -4;
+  if(!integrity){
+    return 1;
+  }
+  int rc = 1;
+  for(int i = 0; i < count; i++){
+    int good = integrity_check(addrs[i], &buf[JBOD_BLOCK_SIZE * i], locked);
+    if(good == -1){
+      return -1;
+    }
+    s->corrupt[i] = good == 0;
+    if(good == 0){
+      rc = -6;
+    }
   }
+  __atomic_fetch_add(&blocks_checked, count, __ATOMIC_RELAXED);
+  return rc;
+}
 
-  //get current disk and block where start_addr is located
-  int current_disk = getCurrentDisk(addr);
-  int current_block = getCurrentBlock(addr);
+//helper function to get the old contents of those of the count blocks at addrs with need[i] set into blocks. a cached
+//copy is as new as the JBOD's (newer in write-back mode) and cannot change while the caller is writing the block, so
+//only blocks that are not cached are read from the server, in one request. the caller holds the blocks' stripe locks
+static int load_blocks(const jbod_block_addr_t *addrs, const bool *need, int count, uint8_t *blocks){
+  struct io_scratch *s = &scratch;
+  int batch_len = 0;
+  for(int i = 0; i < count; i++){
+    if(need[i] && cache_peek(addrs[i].disk, addrs[i].block, &blocks[JBOD_BLOCK_SIZE * i]) == -1){
+      s->batch[batch_len] = addrs[i];
+      s->batch_index[batch_len++] = i;
+    }
+  }
+  int rc = read_verified(s->batch, batch_len, s->batch_data, true);
+  if(rc != 1){
+    return rc;
+  }
+  for(int b = 0; b < batch_len; b++){
+    memcpy(&blocks[JBOD_BLOCK_SIZE * s->batch_index[b]], &s->batch_data[JBOD_BLOCK_SIZE * b], JBOD_BLOCK_SIZE);
+  }
+  return 1;
+}
 
-  //set current I/O position to current disk and block
-  jbod_client_operation(buildOperation(current_disk, 0, JBOD_SEEK_TO_DISK), NULL);
-  jbod_client_operation(buildOperation(0, current_block, JBOD_SEEK_TO_BLOCK), NULL);
+//helper function to store the new contents of the count blocks at addrs. in write-back mode a block only goes into
+//the cache; the others (and any that cannot be cached) are written through to the server in one request, and then
+//inserted into the cache (or refreshed if they are already cached). the caller holds the blocks' stripe locks
+static int store_blocks(const jbod_block_addr_t *addrs, const uint8_t *blocks, int count){
+  struct io_scratch *s = &scratch;
+  int batch_len = 0;
+  for(int i = 0; i < count; i++){
+    const uint8_t *block = &blocks[JBOD_BLOCK_SIZE * i];
+    if(!write_back || !cache_write_back(addrs[i].disk, addrs[i].block, block)){
+      s->batch[batch_len] = addrs[i];
+      memcpy(&s->batch_data[JBOD_BLOCK_SIZE * batch_len++], block, JBOD_BLOCK_SIZE);
+    }
+  }
+  if(jbod_client_write_blocks(s->batch, batch_len, s->batch_data) == -1){
+    return -1;
+  }
+  for(int b = 0; b < batch_len; b++){
+    if(integrity){
+      integrity_note(s->batch[b], &s->batch_data[JBOD_BLOCK_SIZE * b]);
+    }
+    cache_insert(s->batch[b].disk, s->batch[b].block, &s->batch_data[JBOD_BLOCK_SIZE * b]);
+  }
+  //under RAID-10 the same blocks go to the mirrors as a second request
+  if(layout == MDADM_LAYOUT_RAID10){
+    for(int b = 0; b < batch_len; b++){
+      s->batch[b] = mirrorOf(s->batch[b]);
+    }
+    return jbod_client_write_blocks(s->batch, batch_len, s->batch_data);
+  }
+  return 1;
+}
 
-  //only 256 bytes per block but read_len can be up to 1024 bytes so many need to read multiple blocks
-  //determine number of blocks to read
-  int num_blocks_to_read = numBlocksCovered(addr, len);
+//helper function to copy the bytes of p that have been written over block
+static void pending_merge(uint8_t *block, const pending_block_t *p){
+  for(int j = 0; j < JBOD_BLOCK_SIZE; j++){
+    if(p->mask[j / 8] & (1 << (j % 8))){
+      block[j] = p->data[j];
+    }
+  }
+}
 
-  //create temporary array to read all block data to when calling JBOD_READ_BLOCK
-  uint8_t read_block_data_to[num_blocks_to_read * JBOD_BLOCK_SIZE];
+//helper function to check whether every byte of p has been written
+static bool pending_full(const pending_block_t *p){
+  for(int j = 0; j < JBOD_BLOCK_SIZE / 8; j++){
+    if(p->mask[j] != 0xff){
+      return false;
+    }
+  }
+  return true;
+}
 
-  //need to read num_blocks_to_read times since JBOD_READ_BLOCK operation only reads one block at a time
-  for(int i = 0; i < num_blocks_to_read; i++){
-    //check if next block is on next disk, if it is, seek to next disk and its first block
-    if(current_block >= JBOD_NUM_BLOCKS_PER_DISK){
-      current_disk++;
-      current_block = 0;
-      jbod_client_operation(buildOperation(current_disk, 0, JBOD_SEEK_TO_DISK), NULL);
-      jbod_client_operation(buildOperation(0, current_block, JBOD_SEEK_TO_BLOCK), NULL);
+static int pending_compare(const void *a, const void *b){
+  return ((const pending_block_t *)a)->key - ((const pending_block_t *)b)->key;
+}
+
+//helper function to write out every pending block, with pending_lock held. the blocks go out in ascending order as
+//one batch, and only the ones that were not written in full need their old contents. their stripes are locked while
+//they are written, so a reader re-checking one of them (see integrity_check) waits for it. if that fails the blocks
+//stay pending
+static int pending_flush(void){
+  struct io_scratch *s = &scratch;
+  bool taken[MDADM_LOCK_STRIPES] = {false};
+  if(num_pending == 0){
+    return 1;
+  }
+  qsort(pending, num_pending, sizeof(pending[0]), pending_compare);
+  for(int i = 0; i < num_pending; i++){
+    pending_index[pending[i].key] = i;
+    s->addrs[i] = mapBlock(pending[i].key);
+    s->need[i] = !pending_full(&pending[i]);
+    taken[pending[i].key % MDADM_LOCK_STRIPES] = true;
+  }
+  __atomic_store_n(&pending_generation, pending_generation + 1, __ATOMIC_RELEASE);
+  lock_stripes(taken, true);
+  int rc = load_blocks(s->addrs, s->need, num_pending, s->blocks);
+  for(int i = 0; rc == 1 && i < num_pending; i++){
+    pending_merge(&s->blocks[JBOD_BLOCK_SIZE * i], &pending[i]);
+  }
+  if(rc == 1){
+    rc = store_blocks(s->addrs, s->blocks, num_pending);
+  }
+  lock_stripes(taken, false);
+  if(rc != 1){
+    return -1;
+  }
+  block_writes_issued += num_pending;
+  for(int i = 0; i < num_pending; i++){
+    pending_index[pending[i].key] = -1;
+  }
+  __atomic_store_n(&num_pending, 0, __ATOMIC_RELEASE);
+  return 1;
+}
+
+//helper function to flush the pending blocks if the oldest of them has waited coalesce_max_age_ms
+static int pending_expire(void){
+  if(coalesce_max_age_ms == 0 || __atomic_load_n(&num_pending, __ATOMIC_ACQUIRE) == 0){
+    return 1;
+  }
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  int rc = 1;
+  pthread_mutex_lock(&pending_lock);
+  long age_ms = (now.tv_sec - pending_since.tv_sec) * 1000 + (now.tv_nsec - pending_since.tv_nsec) / 1000000;
+  if(num_pending > 0 && age_ms >= coalesce_max_age_ms){
+    rc = pending_flush();
+  }
+  pthread_mutex_unlock(&pending_lock);
+  return rc;
+}
+
+//helper functions to copy whatever is pending for the count blocks from key first on into the calling thread's
+//scratch, for a read to lay over what it gets from the cache and the server. the copy is taken before those are
+//read, but reads take no stripe locks, so a flush may land in between, followed by newer writes to the same bytes
+//that are flushed too. laying the old overlay over those would mix two writes in one block, so the read checks with
+//pending_moved afterwards and reads again, holding pending_lock, if a flush has begun since
+static void pending_snapshot_locked(uint32_t first, int count){
+  struct io_scratch *s = &scratch;
+  s->overlay_generation = pending_generation;
+  for(int i = 0; i < count; i++){
+    int p = pending_index[first + i];
+    s->has_overlay[i] = p != -1;
+    if(p != -1){
+      s->overlay[i] = pending[p];
     }
+  }
+}
+
+static void pending_snapshot(uint32_t first, int count){
+  struct io_scratch *s = &scratch;
+  if(__atomic_load_n(&num_pending, __ATOMIC_ACQUIRE) == 0){
+    memset(s->has_overlay, 0, count * sizeof(s->has_overlay[0]));
+    return;
+  }
+  pthread_mutex_lock(&pending_lock);
+  pending_snapshot_locked(first, count);
+  pthread_mutex_unlock(&pending_lock);
+}
+
+//helper function to check whether the overlay pending_snapshot took for count blocks may be out of date, because a
+//flush has begun since. a read without an overlay is never out of date: it only has what the cache or server held
+static bool pending_moved(int count){
+  struct io_scratch *s = &scratch;
+  for(int i = 0; i < count; i++){
+    if(s->has_overlay[i]){
+      return __atomic_load_n(&pending_generation, __ATOMIC_ACQUIRE) != s->overlay_generation;
+    }
+  }
+  return false;
+}
+
+//helper function to merge a write into the pending blocks instead of sending it, flushing them first if the table
+//is full or has expired, and after if it has reached coalesce_threshold blocks
+static int coalesce_write(uint32_t addr, uint32_t len, const uint8_t *buf){
+  if(pending_expire() == -1){
+    return -1;
+  }
+  int rc = 1;
+  pthread_mutex_lock(&pending_lock);
+  for(uint32_t done = 0; done < len && rc != -1;){
+    uint32_t key = (addr + done) / JBOD_BLOCK_SIZE;
+    uint32_t offset = (addr + done) % JBOD_BLOCK_SIZE;
+    uint32_t n = JBOD_BLOCK_SIZE - offset < len - done ? JBOD_BLOCK_SIZE - offset : len - done;
+    int i = pending_index[key];
+    if(i == -1 && num_pending == MDADM_MAX_PENDING && (rc = pending_flush()) == -1){
+      break;
+    }
+    if(i == -1){
+      if(num_pending == 0){
+        clock_gettime(CLOCK_MONOTONIC, &pending_since);
+      }
+      i = num_pending;
+      pending[i].key = key;
+      memset(pending[i].mask, 0, sizeof(pending[i].mask));
+      pending_index[key] = i;
+      __atomic_store_n(&num_pending, num_pending + 1, __ATOMIC_RELEASE);
+    }
+    memcpy(&pending[i].data[offset], buf + done, n);
+    for(uint32_t j = offset; j < offset + n; j++){
+      pending[i].mask[j / 8] |= 1 << (j % 8);
+    }
+    block_writes_requested++;
+    done += n;
+  }
+  if(rc != -1 && num_pending >= coalesce_threshold){
+    rc = pending_flush();
+  }
+  pthread_mutex_unlock(&pending_lock);
+  return rc == -1 ? -1 : (int)len;
+}
+
+int mdadm_set_write_coalescing(int threshold, int max_age_ms){
+  if(threshold < 0 || threshold > MDADM_MAX_PENDING || max_age_ms < 0){
+    return -1;
+  }
+  pthread_mutex_lock(&pending_lock);
+  //turning it off, so nothing may stay pending
+  int rc = threshold == 0 ? pending_flush() : 1;
+  if(rc == 1){
+    if(threshold != 0 && coalesce_threshold == 0){
+      block_writes_requested = 0;
+      block_writes_issued = 0;
+    }
+    coalesce_threshold = threshold;
+    coalesce_max_age_ms = max_age_ms;
+  }
+  pthread_mutex_unlock(&pending_lock);
+  return rc;
+}
+
+static int flush_array(void){
+  //what the calling thread has queued was written before anything being flushed now
+  if(mdadm_queue_drain() == -1){
+    return -1;
+  }
+  pthread_mutex_lock(&pending_lock);
+  int rc = pending_flush();
+  pthread_mutex_unlock(&pending_lock);
+  if(rc == -1){
+    return -1;
+  }
+  if(!write_back || !cache_enabled()){
+    return 1;
+  }
+  return cache_flush();
+}
+
+int mdadm_flush(void){
+  uint64_t start = stats_clock();
+  int rc = flush_array();
+  stats_time(STATS_FLUSH, start);
+  return rc;
+}
+
+void mdadm_print_write_stats(void){
+  pthread_mutex_lock(&pending_lock);
+  if(block_writes_requested > 0){
+    fprintf(stderr, "Write coalescing: block writes: %ld, issued: %ld, saved: %ld (%.1f%%)\n", block_writes_requested,
+            block_writes_issued, block_writes_requested - block_writes_issued,
+            100 * (float) (block_writes_requested - block_writes_issued) / block_writes_requested);
+  }
+  pthread_mutex_unlock(&pending_lock);
+}
+
+//fetches the num_blocks_to_read blocks from first on into the calling thread's scratch, getting every block the cache
+//misses in a single request. as many of the ra_count blocks from ra_start on as still fit in that request are read
+//ahead into the cache with it. returns 1 on success, -1 on failure and -6 if a block is corrupt
+static int fetch_chunk(uint32_t first, int num_blocks_to_read, uint32_t ra_start, int ra_count) {
+  struct io_scratch *s = &scratch;
+
+  //blocks that are not in the cache, collected so they can all be fetched from the server in a single request
+  int num_misses = 0;
+
+  for(int i = 0; i < num_blocks_to_read; i++){
+    //find the disk and block the layout puts it on
+    jbod_block_addr_t where = mapBlock(first + i);
 
     //check if block we are looking for is in cache, calling cache_lookup and passing buffer. if cache_lookup returns -1, block
-    //was not in cache, so we must read normally and then insert it into the cache. If cache_lookup does not return -1, block
-    //was in the cache and was copied to read_block_data_to when cache_lookup was called, so we do not need to read block
-    if(cache_lookup(current_disk, current_block, &read_block_data_to[JBOD_BLOCK_SIZE * i]) == -1){
-      jbod_client_operation(buildOperation(0, 0, JBOD_READ_BLOCK), &read_block_data_to[JBOD_BLOCK_SIZE * i]);
-      cache_insert(current_disk, current_block, &read_block_data_to[JBOD_BLOCK_SIZE * i]);
+    //was not in cache, so we must read it from the server and then insert it into the cache. If cache_lookup does not return
+    //-1, block was in the cache and was copied to the chunk when cache_lookup was called, so we do not need to read block
+    if(cache_lookup(where.disk, where.block, &s->blocks[JBOD_BLOCK_SIZE * i]) == -1){
+      s->batch[num_misses] = readCopy(where);
+      s->batch_index[num_misses++] = i;
+    }
+  }
+
+  //blocks to read ahead are marked with no place in the chunk. ones that are already cached are skipped
+  int ra_done = 0;
+  for(; ra_done < ra_count && num_misses < MDADM_CHUNK_BLOCKS; ra_done++){
+    jbod_block_addr_t where = mapBlock(ra_start + ra_done);
+    if(cache_peek(where.disk, where.block, &s->batch_data[JBOD_BLOCK_SIZE * num_misses]) == -1){
+      s->batch[num_misses] = readCopy(where);
+      s->batch_index[num_misses++] = -1;
+    }
+  }
+  if(ra_count > 0){
+    ra.frontier = ra_start + ra_done;
+  }
+
+  if(num_misses > 0){
+    //a writer on another thread may cache a newer copy of a block while the old one is on its way from the server.
+    //the cache knows a block by its primary copy, whichever copy it is read from
+    for(int m = 0; m < num_misses; m++){
+      jbod_block_addr_t primary = primaryOf(s->batch[m]);
+      s->versions[m] = cache_version(primary.disk, primary.block);
+    }
+    int rc = read_verified(s->batch, num_misses, s->batch_data, false);
+    //a corrupt block that was only being read ahead fails the read that would have used it, not this one
+    for(int m = 0; rc == -6 && m < num_misses; m++){
+      if(s->corrupt[m] && s->batch_index[m] != -1){
+        return -6;
+      }
+    }
+    if(rc == -1){
+      return -1;
+    }
+    for(int m = 0; m < num_misses; m++){
+      jbod_block_addr_t primary = primaryOf(s->batch[m]);
+      if(rc == -6 && s->corrupt[m]){
+        continue;
+      }
+      if(s->batch_index[m] == -1){
+        cache_prefetch(primary.disk, primary.block, &s->batch_data[JBOD_BLOCK_SIZE * m], s->versions[m]);
+        continue;
+      }
+      memcpy(&s->blocks[JBOD_BLOCK_SIZE * s->batch_index[m]], &s->batch_data[JBOD_BLOCK_SIZE * m], JBOD_BLOCK_SIZE);
+      cache_fill(primary.disk, primary.block, &s->batch_data[JBOD_BLOCK_SIZE * m], s->versions[m]);
+    }
+  }
+  return 1;
+}
+
+//reads one chunk (at most MDADM_CHUNK_BLOCKS blocks), reading ahead as fetch_chunk does
+static int read_chunk(uint32_t addr, uint32_t len, uint8_t *buf, uint32_t ra_start, int ra_count) {
+  struct io_scratch *s = &scratch;
+
+  //get the array block where start_addr is located
+  uint32_t first = addr / JBOD_BLOCK_SIZE;
+
+  //determine number of blocks to read
+  int num_blocks_to_read = numBlocksCovered(addr, len);
+
+  pending_snapshot(first, num_blocks_to_read);
+  int rc = fetch_chunk(first, num_blocks_to_read, ra_start, ra_count);
+  //a flush began while the blocks were read. reading them again with pending_lock held keeps every flush out from
+  //the new overlay until the blocks it goes over have been read, so this happens at most once, at the cost of
+  //writers waiting for the read. what was read ahead the first time is in the cache by now. a block that looked
+  //corrupt may only have been checked against what the flush wrote, so that is read again too
+  if((rc == 1 || rc == -6) && pending_moved(num_blocks_to_read)){
+    pthread_mutex_lock(&pending_lock);
+    pending_snapshot_locked(first, num_blocks_to_read);
+    rc = fetch_chunk(first, num_blocks_to_read, 0, 0);
+    pthread_mutex_unlock(&pending_lock);
+  }
+  if(rc != 1){
+    return rc;
+  }
+
+  //writes still waiting to be coalesced are newer than anything read
+  for(int i = 0; i < num_blocks_to_read; i++){
+    if(s->has_overlay[i]){
+      pending_merge(&s->blocks[JBOD_BLOCK_SIZE * i], &s->overlay[i]);
     }
-    current_block++;
   }
 
   //determine where in blocks read addr begins, and copy from there into buf
-  int overflow = (addr % JBOD_DISK_SIZE) % JBOD_BLOCK_SIZE;
-  memcpy(buf, &read_block_data_to[overflow], len);
+  int overflow = addr % JBOD_BLOCK_SIZE;
+  memcpy(buf, &s->blocks[overflow], len);
+
+  return len;
+}
+
+//helper function to check a read's arguments. returns 0 if it can go ahead, or the error code to return
+static int check_read(uint32_t addr, uint32_t len, const uint8_t *buf, uint32_t max_len){
+  //check to make sure mounted, read_len doesn't exceed max_len bytes, and won't read beyond valid address space
+  if(!mounted){
+    return -3;
+  }
+  if(len > max_len){
+    return -2;
+  }
+  if(addr + len > arraySize()){
+    return -1;
+  }
+  if(buf == NULL && len != 0){
+    return -4;
+  }
+  return 0;
+}
+
+//reads go through whichever client the calling thread has bound (see mdadm_read_ctx). len may be at most max_len
+static int read_bound(uint32_t addr, uint32_t len, uint8_t *buf, uint32_t max_len) {
+  int rc = check_read(addr, len, buf, max_len);
+  if(rc != 0){
+    return rc;
+  }
+
+  if(len == 0){
+    return 0;
+  }
+  if(pending_expire() == -1){
+    return -1;
+  }
+  //the readahead, if any, goes out with the last chunk
+  uint32_t ra_start = 0;
+  int ra_count = readahead_plan(addr / JBOD_BLOCK_SIZE, (addr + len - 1) / JBOD_BLOCK_SIZE + 1, &ra_start);
+
+  //consecutive chunks carry on from the block the previous one ended at, so the server only has to seek when the
+  //transfer crosses onto the next disk
+  uint32_t have_read = 0;
+  while(have_read < len){
+    uint32_t chunk_len = chunkLength(addr + have_read, len - have_read);
+    bool last = have_read + chunk_len == len;
+    rc = read_chunk(addr + have_read, chunk_len, buf + have_read, ra_start, last ? ra_count : 0);
+    if(rc < 0){
+      return rc;
+    }
+    have_read += chunk_len;
+  }
 
   //read was successful, so return length read
   return len;
@@ -161,8 +1094,44 @@ int mdadm_read(uint32_t addr, uint32_t len, uint8_t *buf) {
 
 }
 
-int mdadm_write(uint32_t addr, uint32_t len, const uint8_t *buf) {
-  //make sure has write permission, system is mounted, write_len less than 1024,
+//writes one chunk (at most MDADM_CHUNK_BLOCKS blocks). the caller holds the locks of the blocks being written
+static int write_chunk(uint32_t addr, uint32_t len, const uint8_t *buf) {
+  struct io_scratch *s = &scratch;
+
+  //get the array block where start_addr is located
+  uint32_t first = addr / JBOD_BLOCK_SIZE;
+
+  //determine number of blocks to write based on write_len
+  int num_blocks_to_write = numBlocksCovered(addr, len);
+  //determine where in current block start_addr is
+  int overflow = addr % JBOD_BLOCK_SIZE;
+
+  for(int i = 0; i < num_blocks_to_write; i++){
+    //find the disk and block the layout puts it on
+    s->addrs[i] = mapBlock(first + i);
+    //a block the write covers completely is overwritten whatever it held, so only the first and last blocks can need
+    //their old contents
+    uint32_t block_addr = (first + i) * JBOD_BLOCK_SIZE;
+    s->need[i] = block_addr < addr || block_addr + JBOD_BLOCK_SIZE > addr + len;
+  }
+
+  //read contents of the blocks we are about to change, then copy buf over them from overflow bytes into the first
+  int rc = load_blocks(s->addrs, s->need, num_blocks_to_write, s->blocks);
+  if(rc != 1){
+    return rc;
+  }
+  memcpy(&s->blocks[overflow], buf, len);
+
+  //write blocks with new values back to disk (or the cache)
+  if(store_blocks(s->addrs, s->blocks, num_blocks_to_write) == -1){
+    return -1;
+  }
+  return len;
+}
+
+//helper function to check a write's arguments. returns 0 if it can go ahead, or the error code to return
+static int check_write(uint32_t addr, uint32_t len, const uint8_t *buf, uint32_t max_len){
+  //make sure has write permission, system is mounted, write_len at most max_len,
   //won't write beyond valid address space, and write_buf is null if write_len is not 0
 	if(!mounted){
     return -3;
@@ -170,74 +1139,424 @@ int mdadm_write(uint32_t addr, uint32_t len, const uint8_t *buf) {
   if(!has_write_permission){
 		return -5;
 	}
-  if(len > 1024){
+  if(len > max_len){
     return -2;
   }
-  if((addr + len) > (JBOD_DISK_SIZE * JBOD_NUM_DISKS)){
+  if((addr + len) > arraySize()){
     return -1;
   }
   if(buf == NULL && len != 0){
     return -4;
   }
+  return 0;
+}
 
-//get current disk and block where start_addr is located
-  int current_disk = getCurrentDisk(addr);
-  int current_block = getCurrentBlock(addr);
+//writes go through whichever client the calling thread has bound (see mdadm_write_ctx). len may be at most max_len.
+//each chunk's blocks are locked while it is written, so a large write is atomic per block but not as a whole
+static int write_bound(uint32_t addr, uint32_t len, const uint8_t *buf, uint32_t max_len) {
+  int rc = check_write(addr, len, buf, max_len);
+  if(rc != 0){
+    return rc;
+  }
+  if(coalesce_threshold > 0){
+    return coalesce_write(addr, len, buf);
+  }
 
-  //determine number of blocks to write based on write_len
-  int num_blocks_to_write = numBlocksCovered(addr, len);
-  //determine where in current block start_addr is
-  int overflow = (addr % JBOD_DISK_SIZE) % JBOD_BLOCK_SIZE;
+  uint32_t have_written = 0;
+  while(have_written < len){
+    uint32_t chunk_addr = addr + have_written;
+    uint32_t chunk_len = chunkLength(chunk_addr, len - have_written);
+    uint32_t first = chunk_addr / JBOD_BLOCK_SIZE;
+    int count = numBlocksCovered(chunk_addr, chunk_len);
 
-  //create buffer to read blocks to, replace with write_bumf's values appropriately, and then write to system
-  uint8_t buf1[JBOD_BLOCK_SIZE];
+    lock_blocks(first, count, true);
+    rc = write_chunk(chunk_addr, chunk_len, buf + have_written);
+    lock_blocks(first, count, false);
+    if(rc < 0){
+      return rc;
+    }
+    have_written += chunk_len;
+  }
 
-  int have_written = 0;
-  int remaining_bytes = len;
+  return len;
 
-  //perform read/write operations num_blocks_to_write times
-  for(int i = 0; i < num_blocks_to_write; i++){
-    //if past bounds of current disk, move to 0th block of next disk
-    if(current_block >= JBOD_NUM_BLOCKS_PER_DISK){
-      current_disk++;
-      current_block = 0;
-    }
-    //seek to current disk and block
-    jbod_client_operation(buildOperation(current_disk, 0, JBOD_SEEK_TO_DISK), NULL);
-    jbod_client_operation(buildOperation(0, current_block, JBOD_SEEK_TO_BLOCK), NULL);
-    //read contents from block we are at
-    jbod_client_operation(buildOperation(0, 0, JBOD_READ_BLOCK), &buf1[0]);
-    int to_write;
-    //determine number of bytes to write this iteration (minimum of JBOD_BLOCK_SIZE and remaining bytes to write)
-    if(remaining_bytes < JBOD_BLOCK_SIZE){
-      to_write = remaining_bytes;
+}
+
+//queued submission (see mdadm_queue_start). an operation is queued as one queued_op_t per block it touches, and each
+//dispatch sorts the queue by where the blocks live, so what goes to the server is a run up through the disks
+#define MDADM_QUEUE_MIN_DEPTH 8
+
+typedef struct {
+  //disk * JBOD_NUM_BLOCKS_PER_DISK + block of the block's primary copy, what the queue is sorted by
+  uint32_t key;
+  uint32_t lbn;
+  //the order operations were queued in, and how many the queue had dispatched by then
+  uint32_t seq;
+  uint32_t queued_at;
+  bool write;
+  uint16_t offset;
+  uint16_t len;
+  //where a read's bytes go. a write's bytes are copied into data
+  uint8_t *dst;
+  uint8_t data[JBOD_BLOCK_SIZE];
+} queued_op_t;
+
+struct io_queue {
+  mdadm_sched_t sched;
+  int depth;
+  int count;
+  uint32_t seq;
+  uint32_t dispatched;
+  //key of the last block dispatched, where the next sweep carries on from
+  uint32_t head;
+  queued_op_t *ops;
+  //room to rotate ops into
+  queued_op_t *spare;
+};
+static __thread struct io_queue *queue = NULL;
+
+static const char *sched_names[MDADM_NUM_SCHEDS] = {"scan", "deadline"};
+
+const char *mdadm_sched_name(mdadm_sched_t sched){
+  if(sched < 0 || sched >= MDADM_NUM_SCHEDS){
+    return "unknown";
+  }
+  return sched_names[sched];
+}
+
+int mdadm_sched_from_name(const char *name){
+  for(int k = 0; k < MDADM_NUM_SCHEDS; k++){
+    if(strcasecmp(name, sched_names[k]) == 0){
+      return k;
+    }
+  }
+  return -1;
+}
+
+//sorts by block, and a block's operations in the order they were queued
+static int queued_op_compare(const void *a, const void *b){
+  const queued_op_t *x = a, *y = b;
+  if(x->key != y->key){
+    return x->key < y->key ? -1 : 1;
+  }
+  return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+//helper function to run the first of the n sorted operations at ops, up to MDADM_CHUNK_BLOCKS blocks' worth, as one
+//batch read of the blocks they need, the operations applied to the blocks in order, and one batch write of the blocks
+//that changed. returns how many operations it ran, or -1
+static int queue_run_slice(const queued_op_t *ops, int n){
+  struct io_scratch *s = &scratch;
+  bool taken[MDADM_LOCK_STRIPES] = {false};
+  bool has_read[MDADM_CHUNK_BLOCKS];
+  bool dirty[MDADM_CHUNK_BLOCKS];
+  int num_blocks = 0;
+  int used = 0;
+  for(; used < n; used++){
+    if(used == 0 || ops[used].key != ops[used - 1].key){
+      if(num_blocks == MDADM_CHUNK_BLOCKS){
+        break;
+      }
+      s->addrs[num_blocks] = mapBlock(ops[used].lbn);
+      //a block whose first operation overwrites all of it does not need its old contents
+      s->need[num_blocks] = !ops[used].write || ops[used].len < JBOD_BLOCK_SIZE;
+      has_read[num_blocks] = false;
+      dirty[num_blocks] = false;
+      taken[ops[used].lbn % MDADM_LOCK_STRIPES] = true;
+      num_blocks++;
+    }
+    has_read[num_blocks - 1] |= !ops[used].write;
+  }
+
+  lock_stripes(taken, true);
+  //blocks something reads count towards the hit rate, the ones only written are just peeked at
+  int num_misses = 0;
+  for(int i = 0; i < num_blocks; i++){
+    jbod_block_addr_t where = s->addrs[i];
+    uint8_t *block = &s->blocks[JBOD_BLOCK_SIZE * i];
+    if(s->need[i] && (has_read[i] ? cache_lookup : cache_peek)(where.disk, where.block, block) == -1){
+      s->batch[num_misses] = readCopy(where);
+      s->batch_index[num_misses] = i;
+      s->versions[num_misses++] = cache_version(where.disk, where.block);
+    }
+  }
+  int rc = read_verified(s->batch, num_misses, s->batch_data, true);
+  for(int m = 0; rc == 1 && m < num_misses; m++){
+    jbod_block_addr_t where = s->addrs[s->batch_index[m]];
+    memcpy(&s->blocks[JBOD_BLOCK_SIZE * s->batch_index[m]], &s->batch_data[JBOD_BLOCK_SIZE * m], JBOD_BLOCK_SIZE);
+    cache_fill(where.disk, where.block, &s->batch_data[JBOD_BLOCK_SIZE * m], s->versions[m]);
+  }
+
+  for(int o = 0, i = -1; rc == 1 && o < used; o++){
+    if(o == 0 || ops[o].key != ops[o - 1].key){
+      i++;
+    }
+    uint8_t *bytes = &s->blocks[JBOD_BLOCK_SIZE * i + ops[o].offset];
+    if(ops[o].write){
+      memcpy(bytes, ops[o].data, ops[o].len);
+      dirty[i] = true;
     }
     else{
-      to_write = JBOD_BLOCK_SIZE;
-    }
-    if (i == 0) {
-        if (overflow + to_write > JBOD_BLOCK_SIZE) {
-            to_write = JBOD_BLOCK_SIZE - overflow;
-        }
-        memcpy(&buf1[overflow], buf + have_written, to_write);
-    } else {
-        if (have_written + to_write > len) {
-            to_write = len - have_written;
-        }
-        memcpy(&buf1[0], buf + have_written, to_write);
-    }
-    //seek to current disk and block
-    jbod_client_operation(buildOperation(current_disk, 0, JBOD_SEEK_TO_DISK), NULL);
-    jbod_client_operation(buildOperation(0, current_block, JBOD_SEEK_TO_BLOCK), NULL);
-    //write block with new values back to disk
-    jbod_client_operation(buildOperation(0, 0, JBOD_WRITE_BLOCK), &buf1[0]);
-    current_block++;
-    have_written += to_write;
-    remaining_bytes -= to_write;
-    //insert block we just wrote into cache
-    cache_insert(current_disk, current_block, &buf1[JBOD_BLOCK_SIZE * i]);
+      memcpy(ops[o].dst, bytes, ops[o].len);
+    }
+  }
+
+  //only the blocks that were written go back, moved to the front
+  int num_dirty = 0;
+  for(int i = 0; i < num_blocks; i++){
+    if(!dirty[i]){
+      continue;
+    }
+    if(num_dirty != i){
+      s->addrs[num_dirty] = s->addrs[i];
+      memcpy(&s->blocks[JBOD_BLOCK_SIZE * num_dirty], &s->blocks[JBOD_BLOCK_SIZE * i], JBOD_BLOCK_SIZE);
+    }
+    num_dirty++;
+  }
+  if(rc == 1){
+    rc = store_blocks(s->addrs, s->blocks, num_dirty);
+  }
+  lock_stripes(taken, false);
+  return rc == 1 ? used : -1;
+}
+
+//helper function to dispatch n of the queue's operations in one sweep. they leave the queue whether or not they ran
+static int queue_dispatch(struct io_queue *q, int n){
+  if(n > q->count){
+    n = q->count;
+  }
+  if(n == 0){
+    return 1;
+  }
+  //anything still being coalesced was written before what is queued
+  if(coalesce_threshold > 0){
+    pthread_mutex_lock(&pending_lock);
+    int rc = pending_flush();
+    pthread_mutex_unlock(&pending_lock);
+    if(rc == -1){
+      return -1;
+    }
   }
 
+  qsort(q->ops, q->count, sizeof(queued_op_t), queued_op_compare);
+  //the sweep carries on up from the block the last one stopped at, wrapping round to the lowest block
+  int start = 0;
+  while(start < q->count && q->ops[start].key < q->head){
+    start++;
+  }
+  if(start == q->count){
+    start = 0;
+  }
+  //unless the oldest operation has waited too long, in which case the sweep starts there. it is the first of its
+  //block's operations, like every other place a sweep can start, so no block's operations are run out of order
+  if(q->sched == MDADM_SCHED_DEADLINE){
+    int oldest = 0;
+    for(int i = 1; i < q->count; i++){
+      if(q->ops[i].seq < q->ops[oldest].seq){
+        oldest = i;
+      }
+    }
+    if(q->dispatched - q->ops[oldest].queued_at >= (uint32_t) q->depth){
+      start = oldest;
+    }
+  }
+  //rotate the queue so the sweep is its first n operations
+  memcpy(q->spare, &q->ops[start], (q->count - start) * sizeof(queued_op_t));
+  memcpy(&q->spare[q->count - start], q->ops, start * sizeof(queued_op_t));
+  queued_op_t *rotated = q->spare;
+  q->spare = q->ops;
+  q->ops = rotated;
+
+  int rc = 1;
+  for(int done = 0; done < n;){
+    int ran = queue_run_slice(&q->ops[done], n - done);
+    if(ran == -1){
+      rc = -1;
+      break;
+    }
+    done += ran;
+  }
+  q->head = q->ops[n - 1].key;
+  q->count -= n;
+  memmove(q->ops, &q->ops[n], q->count * sizeof(queued_op_t));
+  q->dispatched += n;
+  return rc;
+}
+
+//helper function to queue a read into dst or a write of src, both of len > 0 bytes at addr
+static int queue_op(struct io_queue *q, uint32_t addr, uint32_t len, uint8_t *dst, const uint8_t *src){
+  //a full queue dispatches half of itself, leaving the rest to be sorted in with what comes next
+  int num_blocks = numBlocksCovered(addr, len);
+  if(q->count + num_blocks > q->depth){
+    int n = q->count + num_blocks - q->depth;
+    if(queue_dispatch(q, n > q->depth / 2 ? n : q->depth / 2) == -1){
+      return -1;
+    }
+  }
+
+  for(uint32_t done = 0; done < len;){
+    uint32_t lbn = (addr + done) / JBOD_BLOCK_SIZE;
+    uint32_t offset = (addr + done) % JBOD_BLOCK_SIZE;
+    uint32_t n = JBOD_BLOCK_SIZE - offset < len - done ? JBOD_BLOCK_SIZE - offset : len - done;
+    jbod_block_addr_t where = mapBlock(lbn);
+
+    queued_op_t *op = &q->ops[q->count++];
+    op->key = where.disk * JBOD_NUM_BLOCKS_PER_DISK + where.block;
+    op->lbn = lbn;
+    op->seq = q->seq++;
+    op->queued_at = q->dispatched;
+    op->write = src != NULL;
+    op->offset = offset;
+    op->len = n;
+    op->dst = dst != NULL ? dst + done : NULL;
+    if(src != NULL){
+      memcpy(op->data, src + done, n);
+    }
+    done += n;
+  }
   return len;
+}
+
+int mdadm_queue_start(mdadm_sched_t sched, int depth){
+  if(sched < 0 || sched >= MDADM_NUM_SCHEDS || depth < MDADM_QUEUE_MIN_DEPTH || depth > MDADM_QUEUE_MAX_DEPTH){
+    return -1;
+  }
+  if(mdadm_queue_stop() == -1){
+    return -1;
+  }
+  struct io_queue *q = calloc(1, sizeof(*q));
+  queued_op_t *ops = malloc(depth * sizeof(queued_op_t));
+  queued_op_t *spare = malloc(depth * sizeof(queued_op_t));
+  if(q == NULL || ops == NULL || spare == NULL){
+    free(q);
+    free(ops);
+    free(spare);
+    return -1;
+  }
+  q->sched = sched;
+  q->depth = depth;
+  q->ops = ops;
+  q->spare = spare;
+  queue = q;
+  return 1;
+}
+
+int mdadm_queue_stop(void){
+  if(queue == NULL){
+    return 1;
+  }
+  int rc = mdadm_queue_drain();
+  free(queue->ops);
+  free(queue->spare);
+  free(queue);
+  queue = NULL;
+  return rc;
+}
+
+int mdadm_queue_read(uint32_t addr, uint32_t len, uint8_t *buf){
+  if(queue == NULL){
+    return mdadm_read(addr, len, buf);
+  }
+  uint64_t start = stats_clock();
+  int rc = check_read(addr, len, buf, MDADM_MAX_IO_SIZE);
+  if(rc == 0 && len > 0){
+    rc = queue_op(queue, addr, len, buf, NULL);
+  }
+  stats_time(STATS_QUEUE_READ, start);
+  return rc;
+}
+
+int mdadm_queue_write(uint32_t addr, uint32_t len, const uint8_t *buf){
+  if(queue == NULL){
+    return mdadm_write(addr, len, buf);
+  }
+  uint64_t start = stats_clock();
+  int rc = check_write(addr, len, buf, MDADM_MAX_IO_SIZE);
+  if(rc == 0 && len > 0){
+    rc = queue_op(queue, addr, len, NULL, buf);
+  }
+  stats_time(STATS_QUEUE_WRITE, start);
+  return rc;
+}
+
+int mdadm_queue_drain(void){
+  if(queue == NULL){
+    return 1;
+  }
+  uint64_t start = stats_clock();
+  int rc = queue_dispatch(queue, queue->count);
+  stats_time(STATS_QUEUE_DRAIN, start);
+  return rc;
+}
+
+//helper functions to run a read or write on |ctx|'s client, or on the default one if ctx is NULL. the time it takes is
+//recorded against the plain or large call, whichever max_len belongs to. whatever the calling thread has queued was
+//asked for first, so it is dispatched before either runs
+static int read_ctx(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, uint8_t *buf, uint32_t max_len) {
+  if(mdadm_queue_drain() == -1){
+    return -1;
+  }
+  uint64_t start = stats_clock();
+  if(ctx != NULL){
+    pthread_mutex_lock(&ctx->lock);
+  }
+  //a read without a context goes through the default client even if the thread has another one bound
+  jbod_client_t *old = jbod_client_bind(ctx != NULL ? ctx->client : NULL);
+  int rc = read_bound(addr, len, buf, max_len);
+  jbod_client_bind(old);
+  if(ctx != NULL){
+    pthread_mutex_unlock(&ctx->lock);
+  }
+  stats_time(max_len == MDADM_MAX_IO_SIZE ? STATS_READ : STATS_READ_LARGE, start);
+  return rc;
+}
+
+static int write_ctx(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, const uint8_t *buf, uint32_t max_len) {
+  if(mdadm_queue_drain() == -1){
+    return -1;
+  }
+  uint64_t start = stats_clock();
+  if(ctx != NULL){
+    pthread_mutex_lock(&ctx->lock);
+  }
+  jbod_client_t *old = jbod_client_bind(ctx != NULL ? ctx->client : NULL);
+  int rc = write_bound(addr, len, buf, max_len);
+  jbod_client_bind(old);
+  if(ctx != NULL){
+    pthread_mutex_unlock(&ctx->lock);
+  }
+  stats_time(max_len == MDADM_MAX_IO_SIZE ? STATS_WRITE : STATS_WRITE_LARGE, start);
+  return rc;
+}
+
+int mdadm_read(uint32_t addr, uint32_t len, uint8_t *buf) {
+  return read_ctx(NULL, addr, len, buf, MDADM_MAX_IO_SIZE);
+}
+
+int mdadm_write(uint32_t addr, uint32_t len, const uint8_t *buf) {
+  return write_ctx(NULL, addr, len, buf, MDADM_MAX_IO_SIZE);
+}
+
+int mdadm_read_ctx(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, uint8_t *buf) {
+  return read_ctx(ctx, addr, len, buf, MDADM_MAX_IO_SIZE);
+}
+
+int mdadm_write_ctx(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, const uint8_t *buf) {
+  return write_ctx(ctx, addr, len, buf, MDADM_MAX_IO_SIZE);
+}
+
+int mdadm_read_large(uint32_t addr, uint32_t len, uint8_t *buf) {
+  return read_ctx(NULL, addr, len, buf, MDADM_MAX_LARGE_IO_SIZE);
+}
+
+int mdadm_write_large(uint32_t addr, uint32_t len, const uint8_t *buf) {
+  return write_ctx(NULL, addr, len, buf, MDADM_MAX_LARGE_IO_SIZE);
+}
+
+int mdadm_read_large_ctx(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, uint8_t *buf) {
+  return read_ctx(ctx, addr, len, buf, MDADM_MAX_LARGE_IO_SIZE);
+}
 
+int mdadm_write_large_ctx(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, const uint8_t *buf) {
+  return write_ctx(ctx, addr, len, buf, MDADM_MAX_LARGE_IO_SIZE);
 }
@@ -4,23 +4,203 @@
 #include <stdint.h>
 #include "jbod.h"
 #include "cache.h"
+#include "net.h"
+
+/* The most bytes mdadm_read and mdadm_write transfer in one call. */
+#define MDADM_MAX_IO_SIZE 1024
+
+/* The most bytes mdadm_read_large and mdadm_write_large transfer in one call:
+ * every disk's worth (the whole array, unless it is mirrored). */
+#define MDADM_MAX_LARGE_IO_SIZE (JBOD_NUM_DISKS * JBOD_DISK_SIZE)
+
+/* Ways the array's blocks can be laid out over the disks. Linear fills each
+ * disk in turn. RAID-0 stripes the array over every disk a chunk at a time,
+ * so consecutive chunks are on different disks. RAID-10 stripes it over the
+ * first half of the disks the same way and keeps a mirror of each on the
+ * second half, which halves the array's size. */
+typedef enum {
+  MDADM_LAYOUT_LINEAR,
+  MDADM_LAYOUT_RAID0,
+  MDADM_LAYOUT_RAID10,
+  MDADM_NUM_LAYOUTS,
+} mdadm_layout_t;
+
+/* The chunk size, in blocks, the striped layouts use unless told otherwise. */
+#define MDADM_DEFAULT_CHUNK_BLOCKS 16
+
+/* Return 1 on success and -1 on failure. Sets the layout the next mount
+ * uses, and the chunk size in blocks (a power of two, at most
+ * JBOD_NUM_BLOCKS_PER_DISK) for the striped layouts. Fails while mounted. The
+ * default is linear. Data written under one layout reads back as garbage
+ * under another. */
+int mdadm_set_layout(mdadm_layout_t layout, int chunk_blocks);
+
+/* Returns the printable name of |layout|, e.g. "raid0". */
+const char *mdadm_layout_name(mdadm_layout_t layout);
+
+/* Returns the layout named |name| (case insensitive), or -1 if there is no
+ * such layout. */
+int mdadm_layout_from_name(const char *name);
+
+/* Return 1 on success and -1 on failure. Turns integrity mode on or off for
+ * the next mount. Fails while mounted. In integrity mode every block has a
+ * CRC32C in a table: it is set whenever the block is written, and every block
+ * read from the JBOD (but not from the cache) is checked against it, so a
+ * read or write that comes across a block the JBOD changed behind the array's
+ * back returns -6. A block the table has no checksum for yet is taken as it
+ * is the first time it is read. Each mount starts the table from
+ * |table_path|, if it is not NULL and holds one, and mdadm_unmount saves it
+ * back there; a table left behind by a different array, or by writes made
+ * outside integrity mode, makes every block they changed read as corrupt. */
+int mdadm_set_integrity(int enable, const char *table_path);
+
+/* Prints how many blocks read from the JBOD were checked in integrity mode,
+ * how many of them the table had no checksum for, and how many were
+ * corrupt. */
+void mdadm_print_integrity_stats(void);
 
 /* Return 1 on success and -1 on failure */
 int mdadm_mount(void);
 
-/* Return 1 on success and -1 on failure */
+/* Return 1 on success and -1 on failure. Flushes dirty blocks first when in
+ * write-back mode. */
 int mdadm_unmount(void);
 
+/* Return 1 on success and -1 on failure. Turns write-back mode on or off.
+ * In write-back mode mdadm_write only updates the cache and marks the blocks
+ * dirty; they are written to the JBOD when evicted, on mdadm_flush, or on
+ * mdadm_unmount. Without a cache, writes still go straight through. Turning
+ * it off flushes first. */
+int mdadm_set_write_back(int enable);
+
+/* Return 1 on success and -1 on failure. Drains the calling thread's queue
+ * (see mdadm_queue_start), writes out every block waiting to be coalesced
+ * (see below), and then, in write-back mode, every dirty cached
+ * block to the JBOD. */
+int mdadm_flush(void);
+
+/* Return 1 on success and -1 on failure. Turns write coalescing on, or off if
+ * |threshold| is 0 (the default), flushing first. While it is on, writes only
+ * merge their bytes into a table of pending blocks, so small writes to the
+ * same block become one block write. The table is written out in block
+ * order, as one batch, once it holds |threshold| blocks (at most
+ * JBOD_MAX_BATCH), on the first read or write made once its oldest write is
+ * |max_age_ms| old (0 for never), and on mdadm_flush and mdadm_unmount.
+ * Reads see pending writes. */
+int mdadm_set_write_coalescing(int threshold, int max_age_ms);
+
+/* Prints how many block writes were asked for while write coalescing was on
+ * and how many of them were actually issued. */
+void mdadm_print_write_stats(void);
+
+/* Return 1 on success and -1 on failure. Turns readahead on, reading up to
+ * |max_blocks| blocks (at most JBOD_MAX_BATCH) ahead of each thread's
+ * sequential reads into the cache, or off if |max_blocks| is 0 (the
+ * default). The window starts small and doubles while the thread keeps
+ * reading sequentially, and each window is fetched in the same request as the
+ * read that triggers it. Needs a cache. */
+int mdadm_set_readahead(int max_blocks);
+
+/* Orders a queue can dispatch its operations in (see mdadm_queue_start). */
+typedef enum {
+  MDADM_SCHED_SCAN,
+  MDADM_SCHED_DEADLINE,
+  MDADM_NUM_SCHEDS,
+} mdadm_sched_t;
+
+/* The most blocks a queue can hold. */
+#define MDADM_QUEUE_MAX_DEPTH 256
+
+/* Returns the printable name of |sched|, e.g. "scan". */
+const char *mdadm_sched_name(mdadm_sched_t sched);
+
+/* Returns the scheduler named |name| (case insensitive), or -1 if there is
+ * no such scheduler. */
+int mdadm_sched_from_name(const char *name);
+
+/* Return 1 on success and -1 on failure. Gives the calling thread a queue of
+ * up to |depth| blocks (at least 8, at most MDADM_QUEUE_MAX_DEPTH) that
+ * mdadm_queue_read and mdadm_queue_write add to, draining any queue it
+ * already had. Once the queue is full, half of it is dispatched in one sweep
+ * up through the (disk, block) addresses, carrying on from where the last
+ * sweep stopped and wrapping round to the start (SCAN), so the server seeks
+ * as little as it can. Operations on the same block are dispatched together
+ * and in the order they were queued, so each block is read once and written
+ * once however many operations touch it. DEADLINE sweeps the same way, but
+ * starts the sweep at the oldest operation once the queue has dispatched
+ * |depth| operations since it was queued, so nothing waits forever. A plain
+ * read or write on the thread (mdadm_read, mdadm_write and their _ctx and
+ * _large variants) drains the queue before it runs, so it sees every write
+ * queued before it and is never overtaken by one. */
+int mdadm_queue_start(mdadm_sched_t sched, int depth);
+
+/* Return 1 on success and -1 on failure. Drains the calling thread's queue
+ * and frees it. */
+int mdadm_queue_stop(void);
+
+/* Same as mdadm_read/mdadm_write, but only queue the operation on the
+ * calling thread's queue, or run it at once if the thread has none. |buf| of
+ * a queued read must stay valid until the read is dispatched; it only holds
+ * the data once mdadm_queue_drain, mdadm_flush or mdadm_unmount returns. A
+ * queued write copies |buf|. A read sees every write queued before it, and
+ * none queued after it. */
+int mdadm_queue_read(uint32_t addr, uint32_t len, uint8_t *buf);
+int mdadm_queue_write(uint32_t addr, uint32_t len, const uint8_t *buf);
+
+/* Return 1 on success and -1 on failure. Dispatches everything on the
+ * calling thread's queue. An operation that fails is dropped with the others
+ * it was dispatched with. */
+int mdadm_queue_drain(void);
+
 int mdadm_write_permission(void);
 
 
 int mdadm_revoke_write_permission(void);
 
 
-/* Return the number of bytes read on success, -1 on failure. */
+/* Return the number of bytes read on success, -1 on failure (-6 on a
+ * corrupt block in integrity mode). Reads at most MDADM_MAX_IO_SIZE bytes. */
 int mdadm_read(uint32_t addr, uint32_t len, uint8_t *buf);
 
-/* Return the number of bytes written on success, -1 on failure. */
+/* Return the number of bytes written on success, -1 on failure. Writes at
+ * most MDADM_MAX_IO_SIZE bytes. */
 int mdadm_write(uint32_t addr, uint32_t len, const uint8_t *buf);
 
+/* Same as mdadm_read/mdadm_write, but transfer up to MDADM_MAX_LARGE_IO_SIZE
+ * bytes. The transfer is streamed through a fixed-size buffer a batch of
+ * JBOD_MAX_BATCH blocks at a time, with the blocks of each batch fetched or
+ * written in one request and a seek only where the transfer crosses onto the
+ * next disk. A large write is applied a batch at a time: a read racing it may
+ * see the batches it has already written and not the rest. */
+int mdadm_read_large(uint32_t addr, uint32_t len, uint8_t *buf);
+int mdadm_write_large(uint32_t addr, uint32_t len, const uint8_t *buf);
+
+/* A context for a thread that reads and writes the array alongside others.
+ * Each context talks to the server over connections of its own, while the
+ * array's state and the cache are shared, so threads holding different
+ * contexts run in parallel. mdadm_read and mdadm_write use the connections
+ * opened by jbod_connect and must only be called from one thread at a time.
+ * Mounting, unmounting, write permission and write-back mode apply to every
+ * context and must not race with reads and writes. Writes to the same block
+ * are serialized; a read racing a write to the same bytes sees either the old
+ * or the new contents of each block. The cache must be created with
+ * cache_create_sharded for threads not to contend on it. */
+typedef struct mdadm_ctx mdadm_ctx_t;
+
+/* Returns a new context connected to the server at |ip| and |port| (which has
+ * to be one that takes several clients, like jbod_server_mt), or NULL on
+ * failure. */
+mdadm_ctx_t *mdadm_ctx_open(const char *ip, uint16_t port);
+
+/* Disconnects and frees a context. */
+void mdadm_ctx_close(mdadm_ctx_t *ctx);
+
+/* Same as mdadm_read/mdadm_write and their _large versions, but go through
+ * |ctx|'s connections (or the jbod_connect ones if |ctx| is NULL). A context
+ * must only be used by one thread at a time. */
+int mdadm_read_ctx(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, uint8_t *buf);
+int mdadm_write_ctx(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, const uint8_t *buf);
+int mdadm_read_large_ctx(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, uint8_t *buf);
+int mdadm_write_large_ctx(mdadm_ctx_t *ctx, uint32_t addr, uint32_t len, const uint8_t *buf);
+
 #endif
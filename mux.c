@@ -0,0 +1,140 @@
+#include <stddef.h>
+
+#include "jbod.h"
+#include "mux.h"
+
+/* runs one single-block command on the JBOD and keeps m's idea of where its
+ * head is in step with it */
+static int device_operation(mux_t *m, uint32_t op, uint8_t *block) {
+  int rc = m->device(op, block);
+
+  switch ((op >> 12) & 0x3f) {
+    case JBOD_MOUNT:
+      if (rc == 0)
+        m->cur_disk = m->cur_block = 0;
+      break;
+    case JBOD_UNMOUNT:
+      m->cur_disk = m->cur_block = -1;
+      break;
+    case JBOD_SEEK_TO_DISK:
+      if (rc == 0) {
+        m->cur_disk = op & 0xf;
+        m->cur_block = 0;
+      } else {
+        m->cur_disk = m->cur_block = -1;
+      }
+      break;
+    case JBOD_SEEK_TO_BLOCK:
+      if (rc == 0)
+        m->cur_block = (op >> 4) & 0xff;
+      else
+        m->cur_block = -1;
+      break;
+    case JBOD_READ_BLOCK:
+    case JBOD_WRITE_BLOCK:
+      if (rc == 0 && m->cur_block != -1)
+        ++m->cur_block;
+      else
+        m->cur_disk = m->cur_block = -1;
+      break;
+  }
+  return rc;
+}
+
+static int release_permission(mux_t *m, mux_client_t *c) {
+  c->write_permission = false;
+  if (--m->permission_count == 0)
+    return device_operation(m, JBOD_REVOKE_WRITE_PERMISSION << 12, NULL);
+  return 0;
+}
+
+static int release_mount(mux_t *m, mux_client_t *c) {
+  c->mounted = false;
+  c->disk = c->block = -1;
+  if (--m->mount_count == 0)
+    return device_operation(m, JBOD_UNMOUNT << 12, NULL);
+  return 0;
+}
+
+void mux_init(mux_t *m, int (*device)(uint32_t op, uint8_t *block)) {
+  *m = (mux_t){.device = device, .cur_disk = -1, .cur_block = -1};
+}
+
+void mux_client_init(mux_client_t *c) {
+  *c = (mux_client_t){.disk = -1, .block = -1};
+}
+
+int mux_block(mux_t *m, mux_client_t *c, int cmd, int disk, int block, uint8_t *buf) {
+  if (!c->mounted || buf == NULL)
+    return -1;
+  //the JBOD does not wrap from the last block of a disk to the next disk
+  if (disk < 0 || disk >= JBOD_NUM_DISKS || block < 0 || block >= JBOD_NUM_BLOCKS_PER_DISK)
+    return -1;
+  if (cmd == JBOD_WRITE_BLOCK && !c->write_permission)
+    return -1;
+  if (m->cur_disk != disk && device_operation(m, JBOD_SEEK_TO_DISK << 12 | disk, NULL) == -1)
+    return -1;
+  if (m->cur_block != block && device_operation(m, JBOD_SEEK_TO_BLOCK << 12 | block << 4, NULL) == -1)
+    return -1;
+  if (device_operation(m, cmd << 12, buf) == -1)
+    return -1;
+  c->disk = disk;
+  c->block = block + 1;
+  return 0;
+}
+
+int mux_operation(mux_t *m, mux_client_t *c, uint32_t op, uint8_t *block) {
+  int cmd = (op >> 12) & 0x3f;
+
+  if (cmd == JBOD_MOUNT) {
+    if (c->mounted || (m->mount_count == 0 && device_operation(m, op, NULL) == -1))
+      return -1;
+    ++m->mount_count;
+    c->mounted = true;
+    c->disk = c->block = 0;
+    return 0;
+  }
+  //a client holding write permission can always give it back
+  if (cmd == JBOD_REVOKE_WRITE_PERMISSION)
+    return c->write_permission ? release_permission(m, c) : -1;
+  if (!c->mounted)
+    return -1;
+
+  switch (cmd) {
+    case JBOD_UNMOUNT:
+      return release_mount(m, c);
+
+    case JBOD_WRITE_PERMISSION:
+      if (c->write_permission || (m->permission_count == 0 && device_operation(m, op, NULL) == -1))
+        return -1;
+      ++m->permission_count;
+      c->write_permission = true;
+      return 0;
+
+    //seeks only move this client's view of the head; the real head follows at its next read or write
+    case JBOD_SEEK_TO_DISK:
+      c->disk = op & 0xf;
+      c->block = 0;
+      return 0;
+
+    case JBOD_SEEK_TO_BLOCK:
+      if (c->disk == -1)
+        return -1;
+      c->block = (op >> 4) & 0xff;
+      return 0;
+
+    case JBOD_READ_BLOCK:
+    case JBOD_WRITE_BLOCK:
+      return c->disk == -1 ? -1 : mux_block(m, c, cmd, c->disk, c->block, block);
+
+    default:
+      return device_operation(m, op, block);
+  }
+}
+
+void mux_release(mux_t *m, mux_client_t *c) {
+  if (c->write_permission)
+    release_permission(m, c);
+  if (c->mounted)
+    release_mount(m, c);
+}
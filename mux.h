@@ -0,0 +1,49 @@
+#ifndef MUX_H_
+#define MUX_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* one JBOD shared by several clients, each of which sees it as if it were
+ * alone: a mount, write permission and head of its own. the JBOD is mounted
+ * (writable) while at least one client has mounted it (been granted write
+ * permission), seeks only move the client's own head, and the real head is
+ * moved there before each of its reads and writes, only if it is not already
+ * there. jbod_server_mt keeps one for its connections and the local backend
+ * one for the clients in the process. nothing here locks: every call on a
+ * mux_t is made with the lock its owner keeps for it held */
+typedef struct {
+  /* runs one single-block command on the JBOD itself; returns 0 on success
+   * and -1 on failure, like jbod_operation */
+  int (*device)(uint32_t op, uint8_t *block);
+  int cur_disk, cur_block; /* where the real head is, -1 when unknown */
+  int mount_count, permission_count;
+} mux_t;
+
+typedef struct {
+  int disk, block; /* where this client's seeks have put its head */
+  bool mounted, write_permission;
+} mux_client_t;
+
+/* Starts m with the JBOD behind device unmounted. */
+void mux_init(mux_t *m, int (*device)(uint32_t op, uint8_t *block));
+
+/* Starts a client that has not mounted the JBOD. */
+void mux_client_init(mux_client_t *c);
+
+/* Runs one single-block command for c; returns 0 on success and -1 on
+ * failure, like jbod_operation. Everything but a mount or giving back write
+ * permission fails unless c itself has mounted the JBOD, whoever else holds
+ * it mounted. */
+int mux_operation(mux_t *m, mux_client_t *c, uint32_t op, uint8_t *block);
+
+/* Reads (JBOD_READ_BLOCK) or writes (JBOD_WRITE_BLOCK) block |block| of disk
+ * |disk| for c, as one entry of a JBOD_READ_N or JBOD_WRITE_N, and leaves c's
+ * head after it. Returns 0 on success and -1 on failure. */
+int mux_block(mux_t *m, mux_client_t *c, int cmd, int disk, int block, uint8_t *buf);
+
+/* Drops c's mount and write permission, for a client that goes away without
+ * cleaning up. */
+void mux_release(mux_t *m, mux_client_t *c);
+
+#endif
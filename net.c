@@ -1,18 +1,58 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <errno.h>
 #include <err.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include "net.h"
 #include "jbod.h"
+#include "local.h"
+#include "stats.h"
+#include "uring.h"
 
-/* the client socket descriptor for the connection to the server */
-int cli_sd = -1;
+/* the client's model of a connection's I/O position, as the server sees it.
+ * head_* is where the server's head actually is (HEAD_UNKNOWN when it cannot
+ * be predicted, e.g. before a mount or after a failed operation), want_* is
+ * where the last seeks asked it to be. seeks only update want_* and are sent,
+ * if still needed, just before the next read or write */
+#define HEAD_UNKNOWN -1
+
+#define SEEK_TO_DISK_COST 500
+#define SEEK_TO_BLOCK_COST 50
+
+/* requests that have been sent on a connection but whose replies have not been
+ * read yet, oldest first. the server answers in order, so the next reply on a
+ * connection always belongs to its in_flight[in_flight_head]. req is NULL for
+ * seeks the client sends on its own behalf. the length of every reply is known
+ * up front, so replies are read straight into header and reply as they
+ * arrive; received counts the bytes of both read so far. a multi-block reply
+ * whose blocks go to scattered places has reply_blocks, a pointer to the
+ * destination of each block, instead of reply */
+typedef struct {
+  jbod_request_t *req;
+  uint8_t *reply;
+  uint8_t *const *reply_blocks;
+  int reply_len;
+  int packet_len;
+  uint8_t header[HEADER_LEN];
+  int received;
+} in_flight_t;
+
+/* a packet's payload is at most this many separate buffers: the address list
+ * of a JBOD_WRITE_N and each of its blocks */
+#define JBOD_MAX_PAYLOAD_IOV (1 + JBOD_MAX_BATCH)
+
+/* the most buffers one receive fills; this is the kernel's limit on iovecs */
+#define JBOD_MAX_RECV_IOV 1024
 
 /* attempts to read n bytes from fd; returns true on success and false on
  * failure */
@@ -39,7 +79,9 @@ bool nread(int fd, int len, uint8_t *buf) {
 
   while(bytes_read < len){
     res = read(fd, &buf[bytes_read], len - bytes_read);
-    if(res == -1){
+    stats_count(STATS_RECV_CALLS);
+    //0 means the server closed the connection, so the rest of the bytes are never coming
+    if(res <= 0){
       return false;
     }
     bytes_read += res;
@@ -74,6 +116,7 @@ bool nwrite(int fd, int len, uint8_t *buf) {
 
   while(bytes_written < len){
     res = write(fd, &buf[bytes_written], len - bytes_written);
+    stats_count(STATS_SEND_CALLS);
     if(res == -1){
       return false;
     }
@@ -82,75 +125,482 @@ bool nwrite(int fd, int len, uint8_t *buf) {
   return true;
 }
 
-/* attempts to receive a packet from fd; returns true on success and false on
- * failure */
-bool recv_packet(int fd, uint32_t *op, uint8_t *ret, uint8_t *block) {
-  //I AM PRETTY SURE OP DOESN'T MATTER WHEN RECEIVING A PACKET. ONLY RET AND BLOCK DO. PROBABLY DON'T EVEN NEED TO BE WORRIED ABOUT OP IN THIS FUNCTION
+/* drops the first n bytes from the byte range described by iov/iovcnt,
+ * after a readv or sendmsg that only got partway through it */
+static void iov_advance(struct iovec **iov, int *iovcnt, size_t n) {
+  while(*iovcnt > 0 && n >= (*iov)->iov_len){
+    n -= (*iov)->iov_len;
+    (*iov)++;
+    (*iovcnt)--;
+  }
+  if(*iovcnt > 0){
+    (*iov)->iov_base = (uint8_t *)(*iov)->iov_base + n;
+    (*iov)->iov_len -= n;
+  }
+}
+
+/* attempts to write every byte described by iov to fd with as few sendmsg
+ * calls as the socket allows; returns true on success and false on failure.
+ * iov is used up in the process */
+static bool nwritev(int fd, struct iovec *iov, int iovcnt, int flags) {
+  if(fd == -1){
+    return false;
+  }
+
+  while(iovcnt > 0){
+    struct msghdr msg = {.msg_iov = iov, .msg_iovlen = iovcnt};
+    ssize_t res = sendmsg(fd, &msg, flags);
+    stats_count(STATS_SEND_CALLS);
+    if(res == -1 && errno == EINTR){
+      continue;
+    }
+    if(res == -1){
+      return false;
+    }
+    iov_advance(&iov, &iovcnt, res);
+  }
+  return true;
+}
+
+typedef struct conn conn_t;
+
+/* how packets get on and off a connection. send copies the header but may
+ * keep pointing at the payload buffers until the reply to the packet has been
+ * read; recv reads whatever has arrived into iov, waiting for at least one
+ * byte, and returns how many bytes it read (0 if the server closed the
+ * connection, -1 on failure); flush gets queued sends moving without waiting
+ * for anything */
+typedef struct {
+  bool (*open)(conn_t *c);
+  void (*close)(conn_t *c);
+  bool (*send)(conn_t *c, const uint8_t *header, const struct iovec *payload, int iovcnt, int flags);
+  ssize_t (*recv)(conn_t *c, struct iovec *iov, int iovcnt);
+  bool (*flush)(conn_t *c);
+} transport_ops_t;
+
+/* the io_uring transport queues every send without making a system call; the
+ * queue goes to the kernel, together with the receive, when a reply is
+ * needed. a burst of pipelined requests and the read of the first reply thus
+ * cost one io_uring_enter instead of a sendmsg each plus a readv. queued sends
+ * are linked so they go out in order, and a send queued while earlier ones
+ * are still in the kernel drains them first */
+#define URING_ENTRIES (2 * JBOD_MAX_IN_FLIGHT)
+#define URING_RECV_TAG UINT64_MAX
+#define URING_CANCEL_TAG (UINT64_MAX - 1)
+
+/* a queued send. the kernel reads msg, iov and header until the send
+ * completes, so they cannot live on the caller's stack */
+typedef struct {
+  uint8_t header[HEADER_LEN];
+  struct iovec iov[1 + JBOD_MAX_PAYLOAD_IOV];
+  struct msghdr msg;
+  size_t len;
+  bool busy;
+} uring_send_t;
+
+/* one connection to the server and everything the client tracks about it */
+struct conn {
+  int sd;
+  const transport_ops_t *transport;
+
+  /* set when the server may leave Nagle's algorithm on, which only older
+   * servers (without JBOD_READ_N/JBOD_WRITE_N) do, so replies have to be
+   * acknowledged as soon as they are read. decided once, at connect time */
+  bool quickack;
+
+  /* io_uring transport. sends_out counts sends handed to the kernel that have
+   * not completed yet; last_send is the last send queued since the previous
+   * submit, so the next one can be linked to it; recv_done/recv_res hold the
+   * result of the receive once its completion has been seen */
+  uring_t ring;
+  uring_send_t sends[URING_ENTRIES];
+  int next_send;
+  int sends_out;
+  struct io_uring_sqe *last_send;
+  bool recv_done;
+  int recv_res;
+  bool broken;
+
+  int head_disk, head_block;
+  int want_disk, want_block;
+
+  in_flight_t in_flight[JBOD_MAX_IN_FLIGHT];
+  int in_flight_head, in_flight_count, in_flight_bytes;
+};
+
+/* a client: a pool of connections to the server. every disk is served by one
+ * of them (disk % num_conns), so the seeks, reads and writes for a disk stay
+ * in order on one connection and its head model stays coherent, while
+ * operations on disks served by different connections travel in parallel.
+ * cur_conn is the connection the last disk seek picked, which the block
+ * seeks, reads and writes that follow it go to. nothing in here is locked,
+ * so a client is only ever used by one thread at a time */
+struct jbod_client {
+  conn_t conns[JBOD_MAX_CONNECTIONS];
+  int num_conns;
+  conn_t *cur_conn;
+
+  /* set when the server understands JBOD_READ_N/JBOD_WRITE_N */
+  bool has_batch;
+
+  /* seeks asked for by the caller and seeks actually sent, with the server
+   * cost of each, so the savings can be reported */
+  int seeks_requested, seeks_sent;
+  int seek_cost_requested, seek_cost_sent;
+
+  /* multi-block reads and writes, and the per-disk requests they were split
+   * into */
+  int batches, disk_requests;
+
+  /* requests sent: packets to the server, or operations run on a local
+   * backend, where a multi-block read or write is one */
+  long requests;
+
+  /* a client on one of the local backends has no connections; its operations
+   * run on the in-process JBOD as local */
+  jbod_backend_t backend;
+  local_conn_t local;
+};
+
+/* jbod_connect connects the default client. every thread starts out with it
+ * bound, and jbod_client_bind points a thread at a client of its own */
+static jbod_client_t default_client;
+static __thread jbod_client_t *client = &default_client;
+
+static int conns_wanted = JBOD_DEFAULT_CONNECTIONS;
+
+static int window = JBOD_MAX_IN_FLIGHT;
+
+static const char *backend_names[JBOD_NUM_BACKENDS] = {"tcp", "local", "image"};
+static jbod_backend_t backend_wanted = JBOD_BACKEND_TCP;
+static const char *image_wanted = JBOD_DEFAULT_IMAGE;
+
+static bool blocking_open(conn_t *c) {
+  return true;
+}
+
+static void blocking_close(conn_t *c) {
+}
 
+/* sends the whole packet before returning, with one sendmsg call unless the
+ * socket buffer fills up */
+static bool blocking_send(conn_t *c, const uint8_t *header, const struct iovec *payload, int iovcnt, int flags) {
+  struct iovec iov[1 + JBOD_MAX_PAYLOAD_IOV];
+  iov[0] = (struct iovec){(void *)header, HEADER_LEN};
+  for(int i = 0; i < iovcnt; i++){
+    iov[1 + i] = payload[i];
+  }
+  return nwritev(c->sd, iov, 1 + iovcnt, flags);
+}
+
+//every packet sent with MSG_MORE is followed by one without it before anything waits for a reply (see sync_head), so
+//nothing is ever left held back
+static bool blocking_flush(conn_t *c) {
+  return true;
+}
+
+static ssize_t blocking_recv(conn_t *c, struct iovec *iov, int iovcnt) {
+  ssize_t res;
+  do{
+    res = readv(c->sd, iov, iovcnt);
+    stats_count(STATS_RECV_CALLS);
+  } while(res == -1 && errno == EINTR);
+  return res;
+}
+
+static const transport_ops_t blocking_ops = {blocking_open, blocking_close, blocking_send, blocking_recv,
+                                             blocking_flush};
+
+static bool uring_open(conn_t *c) {
+  memset(c->sends, 0, sizeof(c->sends));
+  c->next_send = c->sends_out = 0;
+  c->last_send = NULL;
+  c->broken = false;
+  return uring_init(&c->ring, URING_ENTRIES) == 0;
+}
+
+static void uring_close(conn_t *c) {
+  if(c->ring.fd != -1){
+    uring_exit(&c->ring);
+  }
+}
+
+/* consumes every completion that has arrived. a send that did not go out whole
+ * breaks the connection, since the server has lost track of where packets
+ * start */
+static void uring_reap_completions(conn_t *c) {
+  struct io_uring_cqe *cqe;
+  while((cqe = uring_peek_cqe(&c->ring)) != NULL){
+    if(cqe->user_data == URING_RECV_TAG){
+      c->recv_done = true;
+      c->recv_res = cqe->res;
+    }
+    else if(cqe->user_data == URING_CANCEL_TAG){
+      //only the receive it was aimed at matters
+    }
+    else{
+      uring_send_t *u = &c->sends[cqe->user_data];
+      if(cqe->res < 0 || (size_t)cqe->res != u->len){
+        c->broken = true;
+      }
+      u->busy = false;
+      c->sends_out--;
+    }
+    uring_cqe_seen(&c->ring);
+  }
+}
+
+/* hands the queued sends to the kernel, waiting for wait_nr completions */
+static bool uring_push(conn_t *c, unsigned wait_nr) {
+  //a ring uring_cancel_recv had to tear down cannot be entered again
+  if(c->ring.fd == -1){
+    return false;
+  }
+  //nothing follows the last queued send for now, so do not let it sit waiting for more data
+  if(c->last_send != NULL){
+    c->last_send->msg_flags &= ~MSG_MORE;
+  }
+  c->last_send = NULL;
+  if(uring_submit(&c->ring, wait_nr) == -1){
+    c->broken = true;
+  }
+  uring_reap_completions(c);
+  return !c->broken;
+}
+
+/* returns a free submission queue entry, submitting what is queued to make
+ * room if needed */
+static struct io_uring_sqe *uring_sqe(conn_t *c) {
+  struct io_uring_sqe *sqe = uring_get_sqe(&c->ring);
+  if(sqe == NULL && uring_push(c, 0)){
+    sqe = uring_get_sqe(&c->ring);
+  }
+  return sqe;
+}
+
+static bool uring_send(conn_t *c, const uint8_t *header, const struct iovec *payload, int iovcnt, int flags) {
+  uring_send_t *u = &c->sends[c->next_send];
+  while(u->busy && !c->broken){
+    uring_push(c, 1);
+  }
+  struct io_uring_sqe *sqe = c->broken ? NULL : uring_sqe(c);
+  if(sqe == NULL){
+    return false;
+  }
+
+  memcpy(u->header, header, HEADER_LEN);
+  u->iov[0] = (struct iovec){u->header, HEADER_LEN};
+  u->len = HEADER_LEN;
+  for(int i = 0; i < iovcnt; i++){
+    u->iov[1 + i] = payload[i];
+    u->len += payload[i].iov_len;
+  }
+  u->msg = (struct msghdr){.msg_iov = u->iov, .msg_iovlen = 1 + iovcnt};
+  u->busy = true;
+
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = c->sd;
+  sqe->addr = (uintptr_t)&u->msg;
+  sqe->len = 1;
+  //MSG_WAITALL makes the kernel finish a short send itself instead of breaking the link
+  sqe->msg_flags = flags | MSG_WAITALL;
+  sqe->user_data = c->next_send;
+  if(c->last_send != NULL){
+    c->last_send->flags |= IOSQE_IO_LINK;
+  }
+  else if(c->sends_out > 0){
+    sqe->flags |= IOSQE_IO_DRAIN;
+  }
+  c->last_send = sqe;
+  c->sends_out++;
+  c->next_send = (c->next_send + 1) % URING_ENTRIES;
+  return true;
+}
+
+/* makes sure the kernel is done with a receive that has been queued but not
+ * completed, before its msghdr (on uring_recv's stack) and the caller's buffers
+ * are given back: cancels it and waits for its completion. if the ring cannot
+ * even be entered for that, it is torn down and the socket shut down, which
+ * also ends the receive; the connection is broken either way */
+static void uring_cancel_recv(conn_t *c) {
+  while(!c->recv_done){
+    struct io_uring_sqe *sqe = uring_get_sqe(&c->ring);
+    //cancelling again is harmless, so a completion that was not the receive's just sends another
+    if(sqe != NULL){
+      sqe->opcode = IORING_OP_ASYNC_CANCEL;
+      sqe->addr = URING_RECV_TAG;
+      sqe->user_data = URING_CANCEL_TAG;
+    }
+    if(uring_submit(&c->ring, 1) == -1){
+      shutdown(c->sd, SHUT_RDWR);
+      uring_exit(&c->ring);
+      break;
+    }
+    uring_reap_completions(c);
+  }
+  c->broken = true;
+}
+
+static ssize_t uring_recv(conn_t *c, struct iovec *iov, int iovcnt) {
+  struct msghdr msg = {.msg_iov = iov, .msg_iovlen = iovcnt};
+  struct io_uring_sqe *sqe = c->broken ? NULL : uring_sqe(c);
+  if(sqe == NULL){
+    return -1;
+  }
+  sqe->opcode = IORING_OP_RECVMSG;
+  sqe->fd = c->sd;
+  sqe->addr = (uintptr_t)&msg;
+  sqe->len = 1;
+  sqe->user_data = URING_RECV_TAG;
+
+  c->recv_done = false;
+  while(!c->recv_done){
+    if(!uring_push(c, 1)){
+      uring_cancel_recv(c);
+      return -1;
+    }
+  }
+  return c->recv_res < 0 ? -1 : c->recv_res;
+}
+
+static bool uring_flush(conn_t *c) {
+  return uring_push(c, 0);
+}
+
+static const transport_ops_t uring_ops = {uring_open, uring_close, uring_send, uring_recv, uring_flush};
+
+static const char *transport_names[JBOD_NUM_TRANSPORTS] = {"auto", "blocking", "io_uring"};
+static jbod_transport_t transport_wanted = JBOD_TRANSPORT_AUTO;
+
+/* attempts to read every byte described by iov from c, straight into the
+ * buffers it points at; returns true on success and false on failure. iov is
+ * used up in the process */
+static bool nreadv(conn_t *c, struct iovec *iov, int iovcnt) {
+  if(c->sd == -1){
+    return false;
+  }
+
+  while(iovcnt > 0){
+    ssize_t res = c->transport->recv(c, iov, iovcnt);
+    //0 means the server closed the connection, so the rest of the bytes are never coming
+    if(res <= 0){
+      return false;
+    }
+    stats_add(STATS_BYTES_RECEIVED, res);
+    iov_advance(&iov, &iovcnt, res);
+  }
+  return true;
+}
+
+/* attempts to receive a packet whose reply carries exactly len bytes of
+ * payload (0 for none) from c, reading the payload straight into block;
+ * returns true on success and false on failure */
+static bool recv_packet_len(conn_t *c, uint32_t *op, uint8_t *ret, uint8_t *block, int len) {
   //create buffer to read header of packet into
   uint8_t buf[HEADER_LEN];
-  if(!nread(fd, HEADER_LEN, buf)){
+  //servers always send the payload of a read or signature reply, even when it failed, so the whole packet can
+  //be read with one readv instead of a read for the header and another for the payload
+  struct iovec iov[2] = {{buf, HEADER_LEN}, {block, block == NULL ? 0 : len}};
+  if(!nreadv(c, iov, block == NULL || len == 0 ? 1 : 2)){
     return false;
   }
   //successfully read packet header, need to convert it back into op and status format
-  //*op = (buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | (buf[3]);
   memcpy(op, buf, 4);
   //convert op from network byte order to host byte order
   *op = ntohl(*op);
   *ret = buf[4];
 
-  if(block == NULL){
-    return true;
+  //second to last bit of ret says whether a payload came with the header. if that disagrees with what was
+  //read, the next packet is no longer where we think it is
+  return ((*ret & 2) != 0) == (block != NULL && len > 0);
+}
+
+/* attempts to send a packet whose payload is the iovcnt buffers in payload
+ * (none for a bare header) to c, without copying them; returns true on
+ * success and false on failure */
+static bool send_packet_iov(conn_t *c, uint32_t op, const struct iovec *payload, int iovcnt, int flags) {
+  uint8_t buf[HEADER_LEN];
+
+  //convert op from host byte ordering to network byte ordering and pack it into the header
+  op = htonl(op);
+  memcpy(buf, &op, 4);
+  //if there is a payload, set the info code (second to last bit of 5th byte of buf) to 1
+  buf[4] = iovcnt > 0 ? 2 : 0;
+
+  if(!c->transport->send(c, buf, payload, iovcnt, flags)){
+    return false;
   }
-  //check if second to last bit of ret is one, if it is, then payload/block exists and need to read JBOD_BLOCK_SIZE more bytes
-  if(*ret && 2){
-    if(!nread(fd, JBOD_BLOCK_SIZE, block)){
-      return false;
-    }
+  size_t len = HEADER_LEN;
+  for(int i = 0; i < iovcnt; i++){
+    len += payload[i].iov_len;
   }
-
+  stats_add(STATS_BYTES_SENT, len);
   return true;
 }
 
-/* attempts to send a packet to sd; returns true on success and false on
- * failure */
-bool send_packet(int fd, uint32_t op, uint8_t *block) {
-  //create buf for the packet we are going to send
-  uint8_t buf[HEADER_LEN + JBOD_BLOCK_SIZE] = {0};
-  //len of the packet we are going to send (if no payload, it is only the header)
-  int len = HEADER_LEN;
+/* forgets where the server's head is; used whenever a request fails, since a
+ * failed seek, read or write leaves it somewhere the model cannot predict */
+static void lose_head(conn_t *c) {
+  c->head_disk = c->want_disk = HEAD_UNKNOWN;
+  c->head_block = c->want_block = HEAD_UNKNOWN;
+}
 
-  //convert op from host byte ordering to network byte ordering
-  op = htonl(op);
-  //pack op into buf, splitting it into 4 bytes
-  //buf[0] = (op >> 24) & 0xff;
-  //buf[1] = (op >> 16) & 0xff;
-  //buf[2] = (op >> 8) & 0xff;
-  //buf[3] = op & 0xff;
-  //copy OP into buf
-  memcpy(buf, &op, 4);
+/* connects c to the server at caddr and sets up its transport; returns true
+ * on success and false on failure */
+static bool open_conn(conn_t *c, const struct sockaddr_in *caddr) {
+  memset(c, 0, sizeof(*c));
+  c->ring.fd = -1;
+  lose_head(c);
 
-  //if there is a payload, adjust length accordingly, copy block into buf,
-  //and set the info code (second to last bit of 5th byte of buf) to 1
-  if(block != NULL){
-    len += JBOD_BLOCK_SIZE;
-    memcpy(&buf[HEADER_LEN], block, JBOD_BLOCK_SIZE);
-    buf[4] = buf[4] | 2;
+  //create socket, return false if fails
+  c->sd = socket(AF_INET, SOCK_STREAM, 0);
+  if(c->sd == -1){
+    return false;
   }
 
-  //write buf
-  if(!nwrite(fd, len, buf)){
+  //connect to socket, return false if fails
+  if(connect(c->sd, (const struct sockaddr *)caddr, sizeof(*caddr)) == -1){
+    close(c->sd);
+    c->sd = -1;
     return false;
   }
+
+  //pipelined requests are many small writes in a row; without this, Nagle's algorithm holds each one back until the
+  //server acknowledges the previous one
+  int nodelay = 1;
+  setsockopt(c->sd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+  stats_count(STATS_SOCKOPT_CALLS);
+
+  //io_uring may be missing from the kernel or blocked by a sandbox, in which case the blocking calls still work
+  c->transport = &blocking_ops;
+  if(transport_wanted != JBOD_TRANSPORT_BLOCKING && uring_ops.open(c)){
+    c->transport = &uring_ops;
+  }
+  else{
+    c->transport->open(c);
+  }
   return true;
-  
 }
 
-/* connect to server and set the global client variable to the socket */
-bool jbod_connect(const char *ip, uint16_t port) {
-  if(cli_sd != -1){
+static void close_conn(conn_t *c) {
+  close(c->sd);
+  c->sd = -1;
+  c->transport->close(c);
+}
+
+/* connects cl to the server at ip and port; returns true on success and
+ * false on failure */
+static bool client_connect(jbod_client_t *cl, const char *ip, uint16_t port) {
+  if(cl->num_conns > 0 || cl->backend != JBOD_BACKEND_TCP){
     return false;
   }
+  if(backend_wanted != JBOD_BACKEND_TCP){
+    if(!local_open(&cl->local, backend_wanted == JBOD_BACKEND_IMAGE ? image_wanted : NULL)){
+      return false;
+    }
+    cl->backend = backend_wanted;
+    return true;
+  }
   struct sockaddr_in caddr;
   //set to AF_INET for IPv4
   caddr.sin_family = AF_INET;
@@ -160,47 +610,739 @@ bool jbod_connect(const char *ip, uint16_t port) {
     return false;
   }
 
-  //create socket, return false if fails
-  cli_sd = socket(AF_INET, SOCK_STREAM, 0);
-  if(cli_sd == 0){
-    return false;
-  }
-  
-  //connect to socket, return false if fails
-  if(connect(cli_sd, (const struct sockaddr *)&caddr, sizeof(caddr)) == -1){
+  if(!open_conn(&cl->conns[0], &caddr)){
     printf("\nConnecting to socket failed.\n");
     return false;
   }
+  cl->num_conns = 1;
+  cl->cur_conn = &cl->conns[0];
+
+  //an empty JBOD_READ_N succeeds on servers that know the multi-block commands. older servers hand it to
+  //jbod_operation, which rejects it as an unknown command without touching the disks
+  uint32_t op;
+  uint8_t ret;
+  cl->has_batch = send_packet_iov(&cl->conns[0], JBOD_READ_N << 12, NULL, 0, 0) &&
+                  recv_packet_len(&cl->conns[0], &op, &ret, NULL, 0) && !(ret & 1);
+  //the servers that know the multi-block commands are the ones that turn Nagle off, and only they get more
+  //connections, which open_conn leaves with quickack clear
+  cl->conns[0].quickack = !cl->has_batch;
 
+  //older servers serve one client at a time, so a second connection would wait until this one closed. a pool
+  //that comes up short just spreads the disks over fewer connections
+  while(cl->has_batch && cl->num_conns < conns_wanted && open_conn(&cl->conns[cl->num_conns], &caddr)){
+    cl->num_conns++;
+  }
   return true;
+}
 
+//to disconnect, close every connection, or leave the in-process JBOD
+static void client_disconnect(jbod_client_t *cl) {
+  if(cl->backend != JBOD_BACKEND_TCP){
+    local_close(&cl->local);
+    cl->backend = JBOD_BACKEND_TCP;
+  }
+  for(int i = 0; i < cl->num_conns; i++){
+    close_conn(&cl->conns[i]);
+  }
+  cl->num_conns = 0;
+  cl->cur_conn = NULL;
+  cl->has_batch = false;
+}
+
+bool jbod_connect(const char *ip, uint16_t port) {
+  return client_connect(&default_client, ip, port);
 }
 
-//to disconnect, close cli_sd and set cli_sd to -1
 void jbod_disconnect(void) {
-  close(cli_sd);
-  cli_sd = -1;
-  return;
+  client_disconnect(&default_client);
 }
 
-int jbod_client_operation(uint32_t op, uint8_t *block) {
-  if(cli_sd == -1){
+jbod_client_t *jbod_client_open(const char *ip, uint16_t port) {
+  jbod_client_t *cl = calloc(1, sizeof(*cl));
+  if(cl == NULL){
+    return NULL;
+  }
+  if(!client_connect(cl, ip, port)){
+    free(cl);
+    return NULL;
+  }
+  return cl;
+}
+
+void jbod_client_close(jbod_client_t *cl) {
+  if(cl == NULL || cl == &default_client){
+    return;
+  }
+  if(client == cl){
+    client = &default_client;
+  }
+  client_disconnect(cl);
+  free(cl);
+}
+
+jbod_client_t *jbod_client_bind(jbod_client_t *cl) {
+  jbod_client_t *old = client;
+  client = cl != NULL ? cl : &default_client;
+  return old;
+}
+
+/* the connection that serves disk */
+static conn_t *route(int disk) {
+  return &client->conns[disk % client->num_conns];
+}
+
+/* reads whatever part of c's outstanding replies has arrived, waiting for at
+ * least one byte, with a single receive that scatters it across their headers
+ * and reply buffers; returns false if the connection is broken */
+static bool receive_replies(conn_t *c) {
+  struct iovec iov[JBOD_MAX_RECV_IOV];
+  int iovcnt = 0;
+
+  //a receive that runs out of iovecs just leaves the rest for the next one
+  for(int i = 0; i < c->in_flight_count && iovcnt < JBOD_MAX_RECV_IOV - 1; i++){
+    in_flight_t *f = &c->in_flight[(c->in_flight_head + i) % JBOD_MAX_IN_FLIGHT];
+    if(f->received < (int)HEADER_LEN){
+      iov[iovcnt++] = (struct iovec){&f->header[f->received], HEADER_LEN - f->received};
+    }
+    for(int got = f->received < (int)HEADER_LEN ? 0 : f->received - HEADER_LEN;
+        got < f->reply_len && iovcnt < JBOD_MAX_RECV_IOV; ){
+      if(f->reply_blocks == NULL){
+        iov[iovcnt++] = (struct iovec){&f->reply[got], f->reply_len - got};
+        break;
+      }
+      int off = got % JBOD_BLOCK_SIZE;
+      iov[iovcnt++] = (struct iovec){&f->reply_blocks[got / JBOD_BLOCK_SIZE][off], JBOD_BLOCK_SIZE - off};
+      got += JBOD_BLOCK_SIZE - off;
+    }
+  }
+
+  ssize_t res = c->transport->recv(c, iov, iovcnt);
+  //0 means the server closed the connection, so the rest of the bytes are never coming
+  if(res <= 0){
+    return false;
+  }
+  stats_add(STATS_BYTES_RECEIVED, res);
+  for(int i = 0; i < c->in_flight_count && res > 0; i++){
+    in_flight_t *f = &c->in_flight[(c->in_flight_head + i) % JBOD_MAX_IN_FLIGHT];
+    int take = HEADER_LEN + f->reply_len - f->received;
+    if(take > res){
+      take = res;
+    }
+    f->received += take;
+    res -= take;
+  }
+
+  //servers that leave Nagle's algorithm on hold back each reply until the previous one is acknowledged, so
+  //acknowledge these now instead of after the delayed-ACK timeout. jbod_server_mt turns Nagle off, so its replies
+  //need no help and this system call is skipped
+  if(c->quickack){
+    int quickack = 1;
+    setsockopt(c->sd, IPPROTO_TCP, TCP_QUICKACK, &quickack, sizeof(quickack));
+    stats_count(STATS_SOCKOPT_CALLS);
+  }
+  return true;
+}
+
+/* waits for the reply to the oldest request in flight on c and completes it;
+ * returns its status */
+static int reap_one(conn_t *c) {
+  in_flight_t *f = &c->in_flight[c->in_flight_head];
+  bool ok = true;
+  while(ok && f->received < (int)HEADER_LEN + f->reply_len){
+    ok = receive_replies(c);
+  }
+  c->in_flight_head = (c->in_flight_head + 1) % JBOD_MAX_IN_FLIGHT;
+  c->in_flight_count--;
+  c->in_flight_bytes -= f->packet_len;
+
+  int status = 1;
+  //last bit of the info byte contains value returned by jbod_operation call; if it is not 0, then
+  //jbod_operation returned -1 (failure). the second to last bit says whether a payload came with the header,
+  //and if that disagrees with what was read, the next reply is no longer where we think it is
+  if(!ok || (f->header[4] & 1) || ((f->header[4] & 2) != 0) != (f->reply_len > 0)){
+    status = -1;
+    lose_head(c);
+  }
+  if(f->req != NULL){
+    f->req->status = status;
+    if(f->req->done != NULL){
+      f->req->done(f->req);
+    }
+  }
+  return status;
+}
+
+/* sends one packet on c, its payload taken from the iovcnt buffers in payload,
+ * and records it as in flight, first reaping replies while the window (in
+ * requests or in bytes) is full. flags go to sendmsg */
+static int send_request(conn_t *c, jbod_request_t *req, uint32_t op, const struct iovec *payload, int iovcnt,
+                        uint8_t *reply, uint8_t *const *reply_blocks, int reply_len, int flags) {
+  if(reply == NULL && reply_blocks == NULL){
+    reply_len = 0;
+  }
+  int packet_len = HEADER_LEN + reply_len;
+  for(int i = 0; i < iovcnt; i++){
+    packet_len += payload[i].iov_len;
+  }
+  while(c->in_flight_count > 0 &&
+        (c->in_flight_count >= window || c->in_flight_bytes + packet_len > JBOD_MAX_IN_FLIGHT_BYTES)){
+    reap_one(c);
+  }
+
+  if(req != NULL){
+    req->status = 0;
+  }
+  if(!send_packet_iov(c, op, payload, iovcnt, flags)){
+    lose_head(c);
+    if(req != NULL){
+      req->status = -1;
+    }
     return -1;
   }
-  if(!send_packet(cli_sd, op, block)){
+
+  client->requests++;
+  in_flight_t *f = &c->in_flight[(c->in_flight_head + c->in_flight_count) % JBOD_MAX_IN_FLIGHT];
+  f->req = req;
+  f->reply = reply;
+  f->reply_blocks = reply_blocks;
+  f->reply_len = reply_len;
+  f->packet_len = packet_len;
+  f->received = 0;
+  c->in_flight_count++;
+  c->in_flight_bytes += packet_len;
+  return 1;
+}
+
+/* queues the seeks that move the server's head to c's want_disk/want_block,
+ * sending only the ones that actually change its position. the model is
+ * updated as if they succeed; a failure reported later resets it. a
+ * single-block read or write always follows, which goes without MSG_MORE and
+ * pushes the whole burst out, so the seeks are sent with MSG_MORE and leave in
+ * the same segment as it. that is only safe when the window has room for the
+ * whole burst: otherwise sending the read or write first waits for a reply
+ * that may be stuck behind a held-back seek */
+static int sync_head(conn_t *c) {
+  int seeks = (c->want_disk != c->head_disk) + (c->want_block != c->head_block);
+  int burst_len = (seeks + 1) * HEADER_LEN + JBOD_BLOCK_SIZE;
+  int more = c->in_flight_count + seeks + 1 <= window && c->in_flight_bytes + burst_len <= JBOD_MAX_IN_FLIGHT_BYTES
+                 ? MSG_MORE
+                 : 0;
+
+  if(c->want_disk != c->head_disk){
+    if(send_request(c, NULL, JBOD_SEEK_TO_DISK << 12 | c->want_disk, NULL, 0, NULL, NULL, 0, more) == -1){
+      return -1;
+    }
+    c->head_disk = c->want_disk;
+    c->head_block = 0;
+    client->seeks_sent++;
+    client->seek_cost_sent += SEEK_TO_DISK_COST;
+    stats_count(STATS_SEEKS_SENT);
+  }
+  if(c->want_block != c->head_block){
+    if(send_request(c, NULL, JBOD_SEEK_TO_BLOCK << 12 | c->want_block << 4, NULL, 0, NULL, NULL, 0, more) == -1){
+      return -1;
+    }
+    c->head_block = c->want_block;
+    client->seeks_sent++;
+    client->seek_cost_sent += SEEK_TO_BLOCK_COST;
+    stats_count(STATS_SEEKS_SENT);
+  }
+  return 1;
+}
+
+/* sends a single-block operation on c: only writes carry the block to the
+ * server, and only reads and signatures get one back */
+static int send_single(conn_t *c, jbod_request_t *req, uint32_t op, uint8_t *block) {
+  int cmd = (op >> 12) & 0x3f;
+  struct iovec payload = {block, JBOD_BLOCK_SIZE};
+  if(cmd == JBOD_READ_BLOCK || cmd == JBOD_SIGN_BLOCK){
+    return send_request(c, req, op, NULL, 0, block, NULL, JBOD_BLOCK_SIZE, 0);
+  }
+  return send_request(c, req, op, &payload, block == NULL ? 0 : 1, NULL, NULL, 0, 0);
+}
+
+/* mounting and write permission belong to each connection on servers that
+ * take several, so these go to every connection in the pool, and req gets the
+ * worst of their results. they are rare, so this waits for the replies */
+static int submit_everywhere(jbod_request_t *req) {
+  int cmd = (req->op >> 12) & 0x3f;
+  jbod_request_t reqs[JBOD_MAX_CONNECTIONS];
+  int sent = 0;
+
+  req->status = 1;
+  for(; sent < client->num_conns; sent++){
+    conn_t *c = &client->conns[sent];
+    if(cmd == JBOD_MOUNT){
+      c->head_disk = c->want_disk = 0;
+      c->head_block = c->want_block = 0;
+    }
+    else if(cmd == JBOD_UNMOUNT){
+      lose_head(c);
+    }
+    reqs[sent] = (jbod_request_t){.op = req->op, .block = req->block};
+    if(send_single(c, &reqs[sent], req->op, req->block) == -1){
+      req->status = -1;
+      break;
+    }
+  }
+  for(int i = 0; i < sent; i++){
+    while(reqs[i].status == 0 && client->conns[i].in_flight_count > 0){
+      reap_one(&client->conns[i]);
+    }
+    if(reqs[i].status != 1){
+      req->status = -1;
+    }
+  }
+  if(cmd == JBOD_MOUNT){
+    client->cur_conn = route(0);
+  }
+
+  if(req->done != NULL){
+    req->done(req);
+  }
+  return sent == client->num_conns ? 1 : -1;
+}
+
+/* runs req on the in-process JBOD, where there is nothing to wait for, so it
+ * has completed by the time this returns */
+static int local_submit(jbod_request_t *req) {
+  int cmd = (req->op >> 12) & 0x3f;
+  //the device only seeks when a read or write needs it to, so those count as sent in local.c
+  if(cmd == JBOD_SEEK_TO_DISK || cmd == JBOD_SEEK_TO_BLOCK){
+    stats_count(STATS_SEEKS_REQUESTED);
+  }
+  client->requests++;
+  req->status = local_operation(&client->local, req->op, req->block);
+  if(req->done != NULL){
+    req->done(req);
+  }
+  return 1;
+}
+
+int jbod_client_submit(jbod_request_t *req) {
+  stats_count_op(req->op);
+  if(client->backend != JBOD_BACKEND_TCP){
+    return local_submit(req);
+  }
+  if(client->num_conns == 0){
+    req->status = -1;
     return -1;
   }
 
-  uint8_t ret;
-  if(!recv_packet(cli_sd, &op, &ret, block)){
+  uint32_t op = req->op;
+  int cmd = (op >> 12) & 0x3f;
+  int disk = op & 0xf;
+  int blk = (op >> 4) & 0xff;
+  conn_t *c = client->cur_conn;
+
+  switch(cmd){
+    case JBOD_SEEK_TO_DISK:
+    case JBOD_SEEK_TO_BLOCK:
+      //a disk seek picks the connection that serves the disk; everything up to the next one goes there too
+      if(cmd == JBOD_SEEK_TO_DISK){
+        c = client->cur_conn = route(disk);
+      }
+      client->seeks_requested++;
+      client->seek_cost_requested += cmd == JBOD_SEEK_TO_DISK ? SEEK_TO_DISK_COST : SEEK_TO_BLOCK_COST;
+      stats_count(STATS_SEEKS_REQUESTED);
+      //until a mount or a disk seek tells us where the head is, seeks go straight to the server so it can
+      //reject them
+      if(c->want_disk == HEAD_UNKNOWN){
+        client->seeks_sent++;
+        client->seek_cost_sent += cmd == JBOD_SEEK_TO_DISK ? SEEK_TO_DISK_COST : SEEK_TO_BLOCK_COST;
+        stats_count(STATS_SEEKS_SENT);
+        if(cmd == JBOD_SEEK_TO_DISK){
+          c->head_disk = c->want_disk = disk;
+          c->head_block = c->want_block = 0;
+        }
+        return send_single(c, req, op, req->block);
+      }
+      if(cmd == JBOD_SEEK_TO_DISK){
+        c->want_disk = disk;
+        c->want_block = 0;
+      }
+      else{
+        c->want_block = blk;
+      }
+      //nothing to send yet, so the request is already complete
+      req->status = 1;
+      if(req->done != NULL){
+        req->done(req);
+      }
+      return 1;
+
+    case JBOD_READ_BLOCK:
+    case JBOD_WRITE_BLOCK:
+      if(c->want_disk != HEAD_UNKNOWN && sync_head(c) == -1){
+        req->status = -1;
+        return -1;
+      }
+      if(c->head_block != HEAD_UNKNOWN){
+        //the server moves to the next block after every read and write, without wrapping to the next disk
+        c->head_block++;
+      }
+      c->want_disk = c->head_disk;
+      c->want_block = c->head_block;
+      return send_single(c, req, op, req->block);
+
+    case JBOD_MOUNT:
+    case JBOD_UNMOUNT:
+    case JBOD_WRITE_PERMISSION:
+    case JBOD_REVOKE_WRITE_PERMISSION:
+      return submit_everywhere(req);
+
+    case JBOD_SIGN_BLOCK:
+      //signing names its block in the op and leaves the head where it is, so any connection will do
+      return send_single(route(disk), req, op, req->block);
+
+    default:
+      return send_single(c, req, op, req->block);
+  }
+}
+
+/* the connection req is in flight on, or NULL if it has completed */
+static conn_t *conn_holding(jbod_request_t *req) {
+  for(int i = 0; i < client->num_conns; i++){
+    conn_t *c = &client->conns[i];
+    for(int j = 0; j < c->in_flight_count; j++){
+      if(c->in_flight[(c->in_flight_head + j) % JBOD_MAX_IN_FLIGHT].req == req){
+        return c;
+      }
+    }
+  }
+  return NULL;
+}
+
+int jbod_client_wait(jbod_request_t *req) {
+  conn_t *c;
+  while(req->status == 0 && (c = conn_holding(req)) != NULL){
+    reap_one(c);
+  }
+  return req->status == 0 ? -1 : req->status;
+}
+
+/* whether the reply to the oldest request in flight on c has arrived in full,
+ * so reading it will not block */
+static bool reply_ready(conn_t *c) {
+  int avail = 0;
+  if(ioctl(c->sd, FIONREAD, &avail) == -1){
+    return false;
+  }
+  in_flight_t *f = &c->in_flight[c->in_flight_head];
+  return f->received + avail >= (int)HEADER_LEN + f->reply_len;
+}
+
+int jbod_client_reap(int min) {
+  int n = 0;
+  //local requests complete as they are submitted
+  if(client->backend != JBOD_BACKEND_TCP){
+    return 0;
+  }
+  if(client->num_conns == 0){
     return -1;
   }
+  for(int i = 0; i < client->num_conns; i++){
+    if(!client->conns[i].transport->flush(&client->conns[i])){
+      return -1;
+    }
+  }
+
+  for(;;){
+    conn_t *busy = NULL;
+    bool progress = false;
+    for(int i = 0; i < client->num_conns; i++){
+      conn_t *c = &client->conns[i];
+      while(c->in_flight_count > 0 && reply_ready(c)){
+        reap_one(c);
+        n++;
+        progress = true;
+      }
+      if(c->in_flight_count > 0 && busy == NULL){
+        busy = c;
+      }
+    }
+    if(n >= min || busy == NULL){
+      return n;
+    }
+    //nothing more has arrived anywhere, so block on one of the connections still waiting
+    if(!progress){
+      reap_one(busy);
+      n++;
+    }
+  }
+}
 
-  //last bit of ret contains value returned by jbod_operation call
-  //if last bit of ret is not 0, then jbod_operation returned -1 (failure).
-  if(!(ret && 1)){
+int jbod_client_drain(void) {
+  int rc = 1;
+  for(int i = 0; i < client->num_conns; i++){
+    while(client->conns[i].in_flight_count > 0){
+      if(reap_one(&client->conns[i]) == -1){
+        rc = -1;
+      }
+    }
+  }
+  return rc;
+}
+
+int jbod_client_set_window(int n) {
+  if(n < 1 || n > JBOD_MAX_IN_FLIGHT){
     return -1;
   }
+  window = n;
+  return 1;
+}
 
+int jbod_client_set_connections(int n) {
+  if(n < 1 || n > JBOD_MAX_CONNECTIONS){
+    return -1;
+  }
+  conns_wanted = n;
   return 1;
 }
+
+int jbod_client_connections(void) {
+  return client->num_conns;
+}
+
+int jbod_client_set_transport(jbod_transport_t t) {
+  if(t < 0 || t >= JBOD_NUM_TRANSPORTS){
+    return -1;
+  }
+  transport_wanted = t;
+  return 1;
+}
+
+jbod_transport_t jbod_client_transport(void) {
+  if(client->num_conns > 0 && client->conns[0].transport == &uring_ops){
+    return JBOD_TRANSPORT_IO_URING;
+  }
+  return JBOD_TRANSPORT_BLOCKING;
+}
+
+const char *jbod_transport_name(jbod_transport_t t) {
+  if(t < 0 || t >= JBOD_NUM_TRANSPORTS){
+    return "unknown";
+  }
+  return transport_names[t];
+}
+
+int jbod_transport_from_name(const char *name) {
+  for(int t = 0; t < JBOD_NUM_TRANSPORTS; t++){
+    if(strcasecmp(name, transport_names[t]) == 0){
+      return t;
+    }
+  }
+  return -1;
+}
+
+int jbod_client_set_backend(jbod_backend_t b) {
+  if(b < 0 || b >= JBOD_NUM_BACKENDS){
+    return -1;
+  }
+  backend_wanted = b;
+  return 1;
+}
+
+int jbod_client_set_image(const char *path) {
+  if(path == NULL){
+    return -1;
+  }
+  image_wanted = path;
+  return 1;
+}
+
+jbod_backend_t jbod_client_backend(void) {
+  return client->backend;
+}
+
+const char *jbod_backend_name(jbod_backend_t b) {
+  if(b < 0 || b >= JBOD_NUM_BACKENDS){
+    return "unknown";
+  }
+  return backend_names[b];
+}
+
+int jbod_backend_from_name(const char *name) {
+  for(int b = 0; b < JBOD_NUM_BACKENDS; b++){
+    if(strcasecmp(name, backend_names[b]) == 0){
+      return b;
+    }
+  }
+  return -1;
+}
+
+int jbod_client_operation(uint32_t op, uint8_t *block) {
+  jbod_request_t req = {.op = op, .block = block};
+  if(jbod_client_submit(&req) == -1){
+    return -1;
+  }
+  return jbod_client_wait(&req);
+}
+
+/* splits the blocks into one JBOD_READ_N/JBOD_WRITE_N per disk and sends
+ * every one of them, each on the connection serving its disk, before waiting
+ * for any reply. the disks go out in ascending order, which takes the
+ * connections in turn, so each connection starts on its first disk while the
+ * others are still being sent and the disks of different connections are
+ * worked on in parallel. the blocks are gathered from and scattered back into
+ * buf where they are, one iovec per block (or per run of adjacent blocks). the
+ * server seeks to every block itself, so afterwards a connection's head sits
+ * just past the last block it was sent */
+static int batch_round_trips(int cmd, const jbod_block_addr_t *addrs, int count, uint8_t *buf) {
+  //only the address lists are packed; the blocks go out and come back straight from the caller's buffer
+  uint8_t addr_list[JBOD_MAX_BATCH * JBOD_BATCH_ADDR_LEN];
+  uint8_t *blocks[JBOD_MAX_BATCH];
+  jbod_request_t reqs[JBOD_NUM_DISKS];
+  int num_reqs = 0, packed = 0;
+  int rc = 1;
+
+  for(int disk = 0; disk < JBOD_NUM_DISKS && packed < count; disk++){
+    conn_t *c = route(disk);
+    struct iovec payload[JBOD_MAX_PAYLOAD_IOV];
+    int iovcnt = 1, n = 0, last = -1;
+    bool contiguous = true;
+
+    for(int i = 0; i < count; i++){
+      if(addrs[i].disk != disk){
+        continue;
+      }
+      addr_list[(packed + n) * JBOD_BATCH_ADDR_LEN] = addrs[i].disk;
+      addr_list[(packed + n) * JBOD_BATCH_ADDR_LEN + 1] = addrs[i].block;
+      blocks[packed + n] = &buf[i * JBOD_BLOCK_SIZE];
+      if(last != -1 && i == last + 1){
+        payload[iovcnt - 1].iov_len += JBOD_BLOCK_SIZE;
+      }
+      else{
+        contiguous = last == -1;
+        payload[iovcnt++] = (struct iovec){&buf[i * JBOD_BLOCK_SIZE], JBOD_BLOCK_SIZE};
+      }
+      last = i;
+      n++;
+    }
+    if(n == 0){
+      continue;
+    }
+    payload[0] = (struct iovec){&addr_list[packed * JBOD_BATCH_ADDR_LEN], n * JBOD_BATCH_ADDR_LEN};
+
+    jbod_request_t *req = &reqs[num_reqs];
+    *req = (jbod_request_t){.op = (uint32_t)n << JBOD_BATCH_COUNT_SHIFT | cmd << 12};
+    c->head_disk = c->want_disk = addrs[last].disk;
+    c->head_block = c->want_block = addrs[last].block + 1;
+    int sent = cmd == JBOD_WRITE_N
+                   ? send_request(c, req, req->op, payload, iovcnt, NULL, NULL, 0, 0)
+                   : send_request(c, req, req->op, payload, 1, contiguous ? blocks[packed] : NULL,
+                                  contiguous ? NULL : &blocks[packed], n * JBOD_BLOCK_SIZE, 0);
+    if(sent == -1){
+      rc = -1;
+      break;
+    }
+    num_reqs++;
+    packed += n;
+  }
+  client->batches++;
+  client->disk_requests += num_reqs;
+  for(int i = 0; i < num_reqs; i++){
+    if(jbod_client_wait(&reqs[i]) == -1){
+      rc = -1;
+    }
+  }
+  return rc;
+}
+
+/* the fallback for servers without the multi-block commands: a seek pair and a
+ * read or write per block, all sent back to back before waiting for any reply,
+ * with the redundant seeks elided as usual */
+static int single_round_trips(int cmd, const jbod_block_addr_t *addrs, int count, uint8_t *buf) {
+  jbod_request_t reqs[JBOD_MAX_BATCH];
+  int rc = 1;
+
+  for(int i = 0; i < count; i++){
+    jbod_request_t seek_disk = {.op = JBOD_SEEK_TO_DISK << 12 | addrs[i].disk};
+    jbod_request_t seek_block = {.op = JBOD_SEEK_TO_BLOCK << 12 | addrs[i].block << 4};
+    reqs[i] = (jbod_request_t){.op = cmd << 12, .block = &buf[i * JBOD_BLOCK_SIZE]};
+    //seeks are only sent when the head position is unknown, and then their replies have to be read before the
+    //slots above go out of scope
+    if(jbod_client_submit(&seek_disk) == -1 || jbod_client_wait(&seek_disk) == -1 ||
+       jbod_client_submit(&seek_block) == -1 || jbod_client_wait(&seek_block) == -1 ||
+       jbod_client_submit(&reqs[i]) == -1){
+      count = i;
+      rc = -1;
+      break;
+    }
+  }
+  for(int i = 0; i < count; i++){
+    if(jbod_client_wait(&reqs[i]) == -1){
+      rc = -1;
+    }
+  }
+  return rc;
+}
+
+int jbod_client_read_blocks(const jbod_block_addr_t *addrs, int count, uint8_t *buf) {
+  if(count < 0 || count > JBOD_MAX_BATCH){
+    return -1;
+  }
+  if(count > 0){
+    stats_count_op(JBOD_READ_N << 12);
+  }
+  if(client->backend != JBOD_BACKEND_TCP){
+    if(count > 0){
+      client->requests++;
+    }
+    return local_blocks(&client->local, JBOD_READ_BLOCK, addrs, count, buf);
+  }
+  if(client->num_conns == 0){
+    return -1;
+  }
+  if(count == 0){
+    return 1;
+  }
+  if(!client->has_batch){
+    return single_round_trips(JBOD_READ_BLOCK, addrs, count, buf);
+  }
+  return batch_round_trips(JBOD_READ_N, addrs, count, buf);
+}
+
+int jbod_client_write_blocks(const jbod_block_addr_t *addrs, int count, const uint8_t *buf) {
+  if(count < 0 || count > JBOD_MAX_BATCH){
+    return -1;
+  }
+  if(count > 0){
+    stats_count_op(JBOD_WRITE_N << 12);
+  }
+  //the block pointers are only read from when writing, whatever their type says
+  if(client->backend != JBOD_BACKEND_TCP){
+    if(count > 0){
+      client->requests++;
+    }
+    return local_blocks(&client->local, JBOD_WRITE_BLOCK, addrs, count, (uint8_t *)buf);
+  }
+  if(client->num_conns == 0){
+    return -1;
+  }
+  if(count == 0){
+    return 1;
+  }
+  if(!client->has_batch){
+    return single_round_trips(JBOD_WRITE_BLOCK, addrs, count, (uint8_t *)buf);
+  }
+  return batch_round_trips(JBOD_WRITE_N, addrs, count, (uint8_t *)buf);
+}
+
+long jbod_client_requests(void) {
+  return client->requests;
+}
+
+long jbod_client_cost(void) {
+  return client->backend == JBOD_BACKEND_TCP ? -1 : local_cost();
+}
+
+void jbod_client_print_seek_stats(void) {
+  jbod_client_t *cl = client;
+  fprintf(stderr, "Seeks requested: %d, sent: %d, elided: %d, cost saved: %d\n", cl->seeks_requested, cl->seeks_sent,
+          cl->seeks_requested - cl->seeks_sent, cl->seek_cost_requested - cl->seek_cost_sent);
+  if(cl->batches > 0){
+    fprintf(stderr, "Batches: %d, per-disk requests: %d (%.2f disks each, over %d connections)\n", cl->batches,
+            cl->disk_requests, (float) cl->disk_requests / cl->batches, cl->num_conns);
+  }
+}
@@ -8,8 +8,152 @@
 #define JBOD_SERVER "127.0.0.1"
 #define JBOD_PORT 3333
 
+/* multi-block commands understood by jbod_server_mt on top of jbod_cmd_t. the
+ * number of blocks goes in the top bits of the op (JBOD_BATCH_COUNT_SHIFT) and
+ * the payload starts with one (disk, block) byte pair per block, followed for
+ * JBOD_WRITE_N by the contents of every block. a successful JBOD_READ_N reply
+ * carries the contents of every block, in the order they were asked for */
+#define JBOD_READ_N 16
+#define JBOD_WRITE_N 17
+#define JBOD_BATCH_COUNT_SHIFT 20
+#define JBOD_MAX_BATCH 64
+#define JBOD_BATCH_ADDR_LEN 2
+
+typedef struct {
+  uint8_t disk;
+  uint8_t block;
+} jbod_block_addr_t;
+
+/* at most this many requests, and this many bytes of requests and replies,
+ * are outstanding on the connection at once */
+#define JBOD_MAX_IN_FLIGHT 32
+#define JBOD_MAX_IN_FLIGHT_BYTES (64 * 1024)
+
+/* a completion slot for a pipelined request. block is sent with writes and
+ * receives the reply to reads and signatures, so it has to stay valid until
+ * the request completes. status is 0 while the request is in flight and 1 or
+ * -1 once its reply has been read; done, if set, is called at that point */
+typedef struct jbod_request {
+  uint32_t op;
+  uint8_t *block;
+  int status;
+  void (*done)(struct jbod_request *req);
+  void *arg;
+} jbod_request_t;
+
+/* jbod_connect opens a pool of up to this many connections to servers that
+ * take several clients at once, and spreads the disks over them */
+#define JBOD_MAX_CONNECTIONS 16
+#define JBOD_DEFAULT_CONNECTIONS 4
+
+/* how the client moves packets over the connection. JBOD_TRANSPORT_AUTO (the
+ * default) uses io_uring, which batches a burst of requests and the read of
+ * the first reply into one system call, when the kernel allows it, and
+ * blocking socket calls otherwise */
+typedef enum {
+  JBOD_TRANSPORT_AUTO,
+  JBOD_TRANSPORT_BLOCKING,
+  JBOD_TRANSPORT_IO_URING,
+  JBOD_NUM_TRANSPORTS,
+} jbod_transport_t;
+
+/* sends one operation and waits for its reply; returns 1 on success and -1
+ * on failure */
 int jbod_client_operation(uint32_t op, uint8_t *block);
+/* sends req without waiting for the reply (replies are read in order, as
+ * needed to keep the window open); returns -1 if it could not be sent */
+int jbod_client_submit(jbod_request_t *req);
+/* reads replies until req has completed; returns its status */
+int jbod_client_wait(jbod_request_t *req);
+/* completes at least min requests in flight (fewer if there are not that
+ * many), blocking for their replies, and then any whose replies have already
+ * arrived; returns the number completed, or -1 if not connected */
+int jbod_client_reap(int min);
+/* reads every outstanding reply; returns -1 if any of them failed */
+int jbod_client_drain(void);
+/* limits the number of requests in flight (1 makes the client synchronous) */
+int jbod_client_set_window(int n);
+/* picks how many connections the next jbod_connect opens (1 to
+ * JBOD_MAX_CONNECTIONS); servers without JBOD_READ_N/JBOD_WRITE_N serve one
+ * client at a time and always get one. returns -1 if n is out of range */
+int jbod_client_set_connections(int n);
+/* returns the number of connections actually open */
+int jbod_client_connections(void);
+/* picks the transport the next jbod_connect tries; returns -1 if t is not a
+ * transport */
+int jbod_client_set_transport(jbod_transport_t t);
+/* returns the transport the connection actually uses, which is the blocking
+ * one when io_uring could not be set up */
+jbod_transport_t jbod_client_transport(void);
+/* returns the printable name of t, e.g. "io_uring" */
+const char *jbod_transport_name(jbod_transport_t t);
+/* returns the transport named name (case insensitive), or -1 if there is no
+ * such transport */
+int jbod_transport_from_name(const char *name);
+/* where a client's operations go. JBOD_BACKEND_TCP (the default) sends them
+ * to jbod_server. JBOD_BACKEND_LOCAL runs them on jbod_operation in this
+ * process, and JBOD_BACKEND_IMAGE on disks kept in an image file mapped into
+ * this process, which is synced on unmount and survives it. neither local
+ * backend touches a socket, and both take the connection's ip and port as
+ * they come; every client of the process shares the same JBOD */
+typedef enum {
+  JBOD_BACKEND_TCP,
+  JBOD_BACKEND_LOCAL,
+  JBOD_BACKEND_IMAGE,
+  JBOD_NUM_BACKENDS,
+} jbod_backend_t;
+
+/* the image JBOD_BACKEND_IMAGE uses unless told otherwise */
+#define JBOD_DEFAULT_IMAGE "jbod.img"
+
+/* picks the backend the next jbod_connect (or jbod_client_open) uses;
+ * returns -1 if b is not a backend */
+int jbod_client_set_backend(jbod_backend_t b);
+/* picks the image file for JBOD_BACKEND_IMAGE; returns -1 if path is NULL */
+int jbod_client_set_image(const char *path);
+/* returns the backend the bound client is connected to */
+jbod_backend_t jbod_client_backend(void);
+/* returns the printable name of b, e.g. "image" */
+const char *jbod_backend_name(jbod_backend_t b);
+/* returns the backend named name (case insensitive), or -1 if there is no
+ * such backend */
+int jbod_backend_from_name(const char *name);
+/* connects/disconnects the default client, which every thread uses unless
+ * it has bound a client of its own */
 bool jbod_connect(const char *ip, uint16_t port);
 void jbod_disconnect(void);
+/* a client with connections of its own, for a thread that talks to the
+ * server alongside others. a client keeps its own pipeline and head model and
+ * must only be used by one thread at a time */
+typedef struct jbod_client jbod_client_t;
+/* connects a new client (with the transport and number of connections set
+ * for jbod_connect); returns NULL on failure */
+jbod_client_t *jbod_client_open(const char *ip, uint16_t port);
+/* disconnects and frees a client from jbod_client_open, unbinding it from the
+ * calling thread if it was bound there */
+void jbod_client_close(jbod_client_t *cl);
+/* makes every jbod_client_* call (and jbod_client_print_seek_stats) made by
+ * the calling thread go through cl, or through the default client if cl is
+ * NULL; returns the client that was bound before */
+jbod_client_t *jbod_client_bind(jbod_client_t *cl);
+/* reads/writes count blocks (at most JBOD_MAX_BATCH) with one request per
+ * disk when the server supports JBOD_READ_N/JBOD_WRITE_N, all sent before
+ * any reply is waited for so the disks' connections work in parallel, and
+ * one block at a time otherwise. buf holds count * JBOD_BLOCK_SIZE bytes;
+ * returns 1 on success and -1 on failure */
+int jbod_client_read_blocks(const jbod_block_addr_t *addrs, int count, uint8_t *buf);
+int jbod_client_write_blocks(const jbod_block_addr_t *addrs, int count, const uint8_t *buf);
+/* returns how many requests the bound client has sent: packets to the server,
+ * or operations run on a local backend, where a multi-block read or write
+ * counts as one */
+long jbod_client_requests(void);
+/* returns what everything run on the JBOD so far has cost on a local backend
+ * (see local_cost), or -1 over TCP, where jbod_server prints its own cost
+ * when it exits */
+long jbod_client_cost(void);
+/* prints how many seeks were never sent because the server's head was
+ * already in place, and the server cost that saved, then how many per-disk
+ * requests the multi-block reads and writes were split into */
+void jbod_client_print_seek_stats(void);
 
 #endif
@@ -0,0 +1,329 @@
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "net.h"
+#include "stats.h"
+
+/* the same as CACHE_LINE_SIZE; stats does not depend on the cache */
+#define STATS_LINE_SIZE 64
+
+/* each thread's counts, in cache lines of their own. only the owning thread
+ * writes them, with relaxed stores so a snapshot taken by another thread reads
+ * whole values. threads are kept on a list while they run, and what a thread
+ * counted is folded into retired when it exits */
+typedef struct thread_stats {
+  stats_t s;
+  struct thread_stats *next;
+} __attribute__((aligned(STATS_LINE_SIZE))) thread_stats_t;
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static thread_stats_t *threads = NULL;
+static stats_t retired;
+/* what had been counted at the last stats_reset, which snapshots subtract, so
+ * a reset never writes to another thread's counters */
+static stats_t baseline;
+static pthread_key_t stats_key;
+static pthread_once_t stats_once = PTHREAD_ONCE_INIT;
+static __thread thread_stats_t *mine = NULL;
+
+static const char *counter_names[STATS_NUM_COUNTERS] = {
+    [STATS_BYTES_SENT] = "bytes_sent",
+    [STATS_BYTES_RECEIVED] = "bytes_received",
+    [STATS_SEND_CALLS] = "send_calls",
+    [STATS_RECV_CALLS] = "recv_calls",
+    [STATS_URING_ENTERS] = "uring_enters",
+    [STATS_SOCKOPT_CALLS] = "sockopt_calls",
+    [STATS_SEEKS_REQUESTED] = "seeks_requested",
+    [STATS_SEEKS_SENT] = "seeks_sent",
+    [STATS_CACHE_HITS] = "cache_hits",
+    [STATS_CACHE_MISSES] = "cache_misses",
+    [STATS_CACHE_INSERTS] = "cache_inserts",
+    [STATS_CACHE_INSERT_REJECTS] = "cache_insert_rejects",
+    [STATS_CACHE_EVICTIONS] = "cache_evictions",
+    [STATS_CACHE_WRITEBACKS] = "cache_writebacks",
+    [STATS_CACHE_PREFETCH_HITS] = "cache_prefetch_hits",
+};
+
+static const char *op_names[STATS_NUM_OPS] = {
+    [JBOD_MOUNT] = "mount",
+    [JBOD_UNMOUNT] = "unmount",
+    [JBOD_SEEK_TO_DISK] = "seek_to_disk",
+    [JBOD_SEEK_TO_BLOCK] = "seek_to_block",
+    [JBOD_READ_BLOCK] = "read_block",
+    [JBOD_WRITE_PERMISSION] = "write_permission",
+    [JBOD_REVOKE_WRITE_PERMISSION] = "revoke_write_permission",
+    [JBOD_WRITE_BLOCK] = "write_block",
+    [JBOD_SIGN_BLOCK] = "sign_block",
+    [STATS_OP_READ_N] = "read_n",
+    [STATS_OP_WRITE_N] = "write_n",
+};
+
+static const char *call_names[STATS_NUM_CALLS] = {
+    [STATS_MOUNT] = "mdadm_mount",
+    [STATS_UNMOUNT] = "mdadm_unmount",
+    [STATS_READ] = "mdadm_read",
+    [STATS_WRITE] = "mdadm_write",
+    [STATS_READ_LARGE] = "mdadm_read_large",
+    [STATS_WRITE_LARGE] = "mdadm_write_large",
+    [STATS_FLUSH] = "mdadm_flush",
+    [STATS_QUEUE_READ] = "mdadm_queue_read",
+    [STATS_QUEUE_WRITE] = "mdadm_queue_write",
+    [STATS_QUEUE_DRAIN] = "mdadm_queue_drain",
+};
+
+/* the counts are all uint64_t, so every helper below walks a stats_t as an
+ * array of them */
+#define STATS_WORDS (sizeof(stats_t) / sizeof(uint64_t))
+
+/* adds every count of from to to, reading from's with relaxed loads since its
+ * thread may still be counting */
+static void stats_sum(stats_t *to, const stats_t *from) {
+  uint64_t *t = (uint64_t *)to;
+  const uint64_t *f = (const uint64_t *)from;
+
+  for (size_t i = 0; i < STATS_WORDS; ++i)
+    t[i] += __atomic_load_n(&f[i], __ATOMIC_RELAXED);
+}
+
+static void stats_retire(void *arg) {
+  thread_stats_t *t = arg;
+
+  pthread_mutex_lock(&stats_lock);
+  for (thread_stats_t **p = &threads; *p != NULL; p = &(*p)->next) {
+    if (*p == t) {
+      *p = t->next;
+      break;
+    }
+  }
+  stats_sum(&retired, &t->s);
+  pthread_mutex_unlock(&stats_lock);
+  free(t);
+}
+
+static void stats_init(void) {
+  pthread_key_create(&stats_key, stats_retire);
+}
+
+/* sets up the calling thread's counts the first time it counts anything.
+ * returns NULL if they could not be allocated, in which case the thread goes
+ * uncounted */
+static stats_t *stats_setup(void) {
+  thread_stats_t *t;
+
+  pthread_once(&stats_once, stats_init);
+  t = aligned_alloc(STATS_LINE_SIZE, sizeof(*t));
+  if (t == NULL)
+    return NULL;
+  memset(t, 0, sizeof(*t));
+  pthread_mutex_lock(&stats_lock);
+  t->next = threads;
+  threads = t;
+  pthread_mutex_unlock(&stats_lock);
+  pthread_setspecific(stats_key, t);
+  mine = t;
+  return &t->s;
+}
+
+/* the counting functions sit on every lookup and packet, so each one bumps
+ * its counter itself rather than going through helpers */
+#define STATS_MINE() (mine != NULL ? &mine->s : stats_setup())
+#define STATS_BUMP(counter, n) __atomic_store_n(&(counter), (counter) + (n), __ATOMIC_RELAXED)
+
+void stats_count(stats_counter_t c) {
+  stats_t *s = STATS_MINE();
+
+  if (s != NULL)
+    STATS_BUMP(s->counters[c], 1);
+}
+
+void stats_add(stats_counter_t c, uint64_t n) {
+  stats_t *s = STATS_MINE();
+
+  if (s != NULL)
+    STATS_BUMP(s->counters[c], n);
+}
+
+void stats_count_op(uint32_t op) {
+  int cmd = (op >> 12) & 0x3f;
+  stats_t *s;
+
+  if (cmd == JBOD_READ_N)
+    cmd = STATS_OP_READ_N;
+  else if (cmd == JBOD_WRITE_N)
+    cmd = STATS_OP_WRITE_N;
+  else if (cmd >= JBOD_NUM_CMDS)
+    return;
+  s = STATS_MINE();
+  if (s != NULL)
+    STATS_BUMP(s->ops[cmd], 1);
+}
+
+uint64_t stats_clock(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int hist_index(uint64_t v) {
+  if (v < 2 * STATS_HIST_SUB)
+    return (int)v;
+  int shift = 63 - __builtin_clzll(v) - STATS_HIST_SUB_BITS;
+  return (shift + 1) * STATS_HIST_SUB + (int)(v >> shift) - STATS_HIST_SUB;
+}
+
+/* the largest value that lands in bucket i */
+static uint64_t hist_value(int i) {
+  if (i < 2 * STATS_HIST_SUB)
+    return i;
+  int shift = i / STATS_HIST_SUB - 1;
+  return ((uint64_t)(STATS_HIST_SUB + i % STATS_HIST_SUB + 1) << shift) - 1;
+}
+
+void stats_record(stats_latency_t *l, uint64_t ns) {
+  STATS_BUMP(l->count, 1);
+  STATS_BUMP(l->total_ns, ns);
+  STATS_BUMP(l->buckets[hist_index(ns)], 1);
+}
+
+void stats_time(stats_call_t call, uint64_t start) {
+  uint64_t ns = stats_clock() - start;
+  stats_t *s = STATS_MINE();
+
+  if (s != NULL)
+    stats_record(&s->calls[call], ns);
+}
+
+/* adds up everything counted since the process started. called with
+ * stats_lock held */
+static void stats_total(stats_t *out) {
+  *out = retired;
+  for (thread_stats_t *t = threads; t != NULL; t = t->next)
+    stats_sum(out, &t->s);
+}
+
+void stats_snapshot(stats_t *out) {
+  uint64_t *o = (uint64_t *)out;
+  const uint64_t *b = (const uint64_t *)&baseline;
+
+  pthread_mutex_lock(&stats_lock);
+  stats_total(out);
+  for (size_t i = 0; i < STATS_WORDS; ++i)
+    o[i] -= b[i];
+  pthread_mutex_unlock(&stats_lock);
+}
+
+void stats_reset(void) {
+  pthread_mutex_lock(&stats_lock);
+  stats_total(&baseline);
+  pthread_mutex_unlock(&stats_lock);
+}
+
+uint64_t stats_counter_total(stats_counter_t c) {
+  uint64_t total;
+
+  pthread_mutex_lock(&stats_lock);
+  total = retired.counters[c];
+  for (thread_stats_t *t = threads; t != NULL; t = t->next)
+    total += __atomic_load_n(&t->s.counters[c], __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&stats_lock);
+  return total;
+}
+
+uint64_t stats_percentile(const stats_latency_t *l, double pct) {
+  uint64_t want = (uint64_t)(l->count * pct / 100.0 + 0.5), seen = 0;
+
+  if (l->count == 0)
+    return 0;
+  if (want < 1)
+    want = 1;
+  for (int i = 0; i < STATS_HIST_BUCKETS; ++i) {
+    seen += l->buckets[i];
+    if (seen >= want)
+      return hist_value(i);
+  }
+  return hist_value(STATS_HIST_BUCKETS - 1);
+}
+
+const char *stats_counter_name(stats_counter_t c) {
+  if (c < 0 || c >= STATS_NUM_COUNTERS)
+    return "unknown";
+  return counter_names[c];
+}
+
+const char *stats_op_name(int op) {
+  if (op < 0 || op >= STATS_NUM_OPS)
+    return "unknown";
+  return op_names[op];
+}
+
+const char *stats_call_name(stats_call_t call) {
+  if (call < 0 || call >= STATS_NUM_CALLS)
+    return "unknown";
+  return call_names[call];
+}
+
+void stats_print(FILE *f) {
+  static stats_t s;
+  static pthread_mutex_t print_lock = PTHREAD_MUTEX_INITIALIZER;
+  const uint64_t *c = s.counters;
+
+  /* a stats_t is too big for a thread's stack to take lightly, so prints share one */
+  pthread_mutex_lock(&print_lock);
+  stats_snapshot(&s);
+  fprintf(f, "Net: %lu bytes sent, %lu received; send calls: %lu, recv calls: %lu, io_uring_enter: %lu, "
+          "setsockopt: %lu\n", c[STATS_BYTES_SENT], c[STATS_BYTES_RECEIVED], c[STATS_SEND_CALLS],
+          c[STATS_RECV_CALLS], c[STATS_URING_ENTERS], c[STATS_SOCKOPT_CALLS]);
+  fprintf(f, "Seeks: %lu requested, %lu sent\n", c[STATS_SEEKS_REQUESTED], c[STATS_SEEKS_SENT]);
+  fprintf(f, "Cache: %lu hits, %lu misses, %lu inserts, %lu rejected, %lu evictions, %lu writebacks\n",
+          c[STATS_CACHE_HITS], c[STATS_CACHE_MISSES], c[STATS_CACHE_INSERTS], c[STATS_CACHE_INSERT_REJECTS],
+          c[STATS_CACHE_EVICTIONS], c[STATS_CACHE_WRITEBACKS]);
+  fprintf(f, "Ops:");
+  for (int op = 0; op < STATS_NUM_OPS; ++op)
+    if (s.ops[op] > 0)
+      fprintf(f, " %s %lu", op_names[op], s.ops[op]);
+  fprintf(f, "\n");
+  for (int call = 0; call < STATS_NUM_CALLS; ++call) {
+    const stats_latency_t *l = &s.calls[call];
+    if (l->count == 0)
+      continue;
+    fprintf(f, "%s: %lu calls, mean %.2f us, p50 %.2f us, p99 %.2f us, p99.9 %.2f us\n", call_names[call],
+            l->count, l->total_ns / 1e3 / l->count, stats_percentile(l, 50) / 1e3, stats_percentile(l, 99) / 1e3,
+            stats_percentile(l, 99.9) / 1e3);
+  }
+  fflush(f);
+  pthread_mutex_unlock(&print_lock);
+}
+
+static int dump_signo = 0;
+
+static void *dump_thread(void *arg) {
+  sigset_t *set = arg;
+  int signo;
+
+  for (;;)
+    if (sigwait(set, &signo) == 0)
+      stats_print(stderr);
+  return NULL;
+}
+
+int stats_dump_on_signal(int signo) {
+  static sigset_t set;
+  pthread_t thread;
+
+  if (dump_signo != 0)
+    return -1;
+  sigemptyset(&set);
+  if (sigaddset(&set, signo) == -1 || pthread_sigmask(SIG_BLOCK, &set, NULL) != 0)
+    return -1;
+  if (pthread_create(&thread, NULL, dump_thread, &set) != 0) {
+    pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+    return -1;
+  }
+  pthread_detach(thread);
+  dump_signo = signo;
+  return 0;
+}
@@ -0,0 +1,137 @@
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "jbod.h"
+
+/* counters kept by mdadm, the cache and the client as they run. every thread
+ * counts into its own cache line, so counting is a plain store that never
+ * contends with other threads; the counts are only added up when they are
+ * read (stats_snapshot) */
+typedef enum {
+  /* bytes of packets sent to and received from jbod_server, headers included */
+  STATS_BYTES_SENT,
+  STATS_BYTES_RECEIVED,
+  /* system calls made to move them: write/sendmsg, read/readv, io_uring_enter
+   * (one covers a burst of sends and a receive) and setsockopt */
+  STATS_SEND_CALLS,
+  STATS_RECV_CALLS,
+  STATS_URING_ENTERS,
+  STATS_SOCKOPT_CALLS,
+  /* seeks asked of the client, and the ones that actually reached the JBOD
+   * after those that would not have moved its head were elided */
+  STATS_SEEKS_REQUESTED,
+  STATS_SEEKS_SENT,
+  /* cache lookups that found / did not find their block, blocks the cache
+   * took in, inserts and fills it turned away (the block was already there,
+   * was overtaken by a newer copy, or no room could be made for it), blocks it
+   * evicted, dirty blocks it wrote back, and hits on prefetched blocks (the
+   * first one on each) */
+  STATS_CACHE_HITS,
+  STATS_CACHE_MISSES,
+  STATS_CACHE_INSERTS,
+  STATS_CACHE_INSERT_REJECTS,
+  STATS_CACHE_EVICTIONS,
+  STATS_CACHE_WRITEBACKS,
+  STATS_CACHE_PREFETCH_HITS,
+  STATS_NUM_COUNTERS,
+} stats_counter_t;
+
+/* operations asked of the client, by jbod_cmd_t, with the multi-block reads
+ * and writes counted once each after them. on servers without those, the
+ * single-block operations they are split into are counted too */
+#define STATS_OP_READ_N JBOD_NUM_CMDS
+#define STATS_OP_WRITE_N (JBOD_NUM_CMDS + 1)
+#define STATS_NUM_OPS (JBOD_NUM_CMDS + 2)
+
+/* the mdadm calls whose latency is recorded. the _ctx variants count as the
+ * calls they wrap, and a call made from inside another (the flush in
+ * mdadm_unmount, say) is recorded as well */
+typedef enum {
+  STATS_MOUNT,
+  STATS_UNMOUNT,
+  STATS_READ,
+  STATS_WRITE,
+  STATS_READ_LARGE,
+  STATS_WRITE_LARGE,
+  STATS_FLUSH,
+  STATS_QUEUE_READ,
+  STATS_QUEUE_WRITE,
+  STATS_QUEUE_DRAIN,
+  STATS_NUM_CALLS,
+} stats_call_t;
+
+/* latencies go into a log-linear histogram: values below 2 * STATS_HIST_SUB ns
+ * have a bucket each, and every power of two above that is split into
+ * STATS_HIST_SUB buckets, so a percentile is never off by more than
+ * 1/STATS_HIST_SUB of its value. bench times its operations into these too */
+#define STATS_HIST_SUB_BITS 5
+#define STATS_HIST_SUB (1 << STATS_HIST_SUB_BITS)
+#define STATS_HIST_BUCKETS ((64 - STATS_HIST_SUB_BITS) * STATS_HIST_SUB)
+
+typedef struct {
+  uint64_t count;
+  uint64_t total_ns;
+  uint64_t buckets[STATS_HIST_BUCKETS];
+} stats_latency_t;
+
+typedef struct {
+  uint64_t counters[STATS_NUM_COUNTERS];
+  uint64_t ops[STATS_NUM_OPS];
+  stats_latency_t calls[STATS_NUM_CALLS];
+} stats_t;
+
+/* adds 1 (stats_count) or n (stats_add) to the calling thread's counter c */
+void stats_count(stats_counter_t c);
+void stats_add(stats_counter_t c, uint64_t n);
+
+/* counts op (a jbod_cmd_t, JBOD_READ_N or JBOD_WRITE_N in the usual encoding)
+ * against its command */
+void stats_count_op(uint32_t op);
+
+/* returns the time a call starts, for stats_time to record how long it took
+ * once it returns */
+uint64_t stats_clock(void);
+void stats_time(stats_call_t call, uint64_t start);
+
+/* fills out with every thread's counts since the last stats_reset, including
+ * those of threads that have exited */
+void stats_snapshot(stats_t *out);
+
+/* starts counting from zero again */
+void stats_reset(void);
+
+/* returns counter c added up over every thread since the process started,
+ * whatever stats_reset has done since, for callers that count from a
+ * starting point of their own */
+uint64_t stats_counter_total(stats_counter_t c);
+
+/* records a call that took ns into l, which only the calling thread may
+ * write (stats_time does this for the mdadm calls) */
+void stats_record(stats_latency_t *l, uint64_t ns);
+
+/* returns the latency (in ns) that pct percent of the calls in l took at
+ * most, or 0 if there were none */
+uint64_t stats_percentile(const stats_latency_t *l, double pct);
+
+/* returns the printable name of c, op (a STATS_OP_* or jbod_cmd_t index) or
+ * call, e.g. "cache_hits", "read_n" or "mdadm_read" */
+const char *stats_counter_name(stats_counter_t c);
+const char *stats_op_name(int op);
+const char *stats_call_name(stats_call_t call);
+
+/* prints a snapshot to f: the counters, the operations that were asked for and
+ * the latency of every mdadm call that was made */
+void stats_print(FILE *f);
+
+/* Returns 0 on success and -1 on failure. Prints the stats to stderr every
+ * time the process gets |signo| (e.g. SIGUSR1). The signal is taken by a
+ * thread of its own with sigwait, so printing is safe whatever the other
+ * threads are doing, but every other thread must block it: call this before
+ * starting any, since they inherit the caller's signal mask. Only one signal
+ * can be set up. */
+int stats_dump_on_signal(int signo);
+
+#endif
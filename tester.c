@@ -9,6 +9,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <err.h>
+#include <signal.h>
 #include <assert.h>
 
 #include "cache.h"
@@ -17,22 +18,59 @@
 #include "util.h"
 #include "tester.h"
 #include "net.h"
+#include "stats.h"
+#include "verify.h"
 
-#define TESTER_ARGUMENTS "hw:s:"
-#define USAGE                                               \
-  "USAGE: test [-h] [-w workload-file] [-s cache_size] \n"  \
-  "\n"                                                      \
-  "where:\n"                                                \
-  "    -h - help mode (display this message)\n"             \
-  "\n"                                                      \
+#define TESTER_ARGUMENTS "hw:s:p:bt:c:r:m:d:l:k:q:n:e:i:j:x:"
+#define USAGE                                                                \
+  "USAGE: test [-h] [-w workload-file] [-s cache_size] [-p policy] [-b] \n"  \
+  "            [-t transport] [-c connections] [-r readahead] \n"            \
+  "            [-m coalesce_threshold] [-d coalesce_delay] [-l layout] \n"  \
+  "            [-k chunk_blocks] [-q scheduler] [-n queue_depth] \n"        \
+  "            [-e backend] [-i image] [-j sign_threads] [-x crc_table] \n" \
+  "\n"                                                                       \
+  "where:\n"                                                                 \
+  "    -h - help mode (display this message)\n"                              \
+  "    -p - cache eviction policy: MRU (default), LRU, CLOCK, 2Q, ARC\n"      \
+  "    -b - write-back mode (writes stay in the cache until evicted)\n"      \
+  "    -t - client transport: auto (default), blocking, io_uring\n"          \
+  "    -c - number of connections to open to the server (default 4)\n"       \
+  "    -r - most blocks to read ahead of sequential reads (default 0, off)\n" \
+  "    -m - coalesce writes, flushing every this many blocks (default 0, off)\n" \
+  "    -d - also flush coalesced writes this many ms old (default 0, never)\n" \
+  "    -l - array layout: linear (default), raid0, raid10\n"                 \
+  "    -k - chunk size in blocks for raid0 and raid10 (default 16)\n"        \
+  "    -q - queue reads and writes and dispatch them with: scan, deadline\n"  \
+  "    -n - most blocks the queue holds (default 64)\n"                       \
+  "    -e - where the JBOD is: tcp (default, jbod_server), local, image\n"    \
+  "    -i - image file for the image backend (default jbod.img)\n"           \
+  "    -j - threads SIGNALL hashes on (default one per CPU), or 0 to have\n"  \
+  "         the JBOD sign each block itself\n"                                \
+  "    -x - checksum every block, keeping the checksums in this file\n"      \
+  "\n"                                                                       \
 
-int run_workload(char *workload, int cache_size);
+int run_workload(char *workload, int cache_size, cache_policy_t policy, int write_back, int readahead,
+                 int coalesce_threshold, int coalesce_delay, int sched, int queue_depth, int sign_threads);
 
 int main(int argc, char *argv[])
 {
   int ch, cache_size = 0;
+  cache_policy_t policy = CACHE_POLICY_MRU;
+  int write_back = 0, readahead = 0, coalesce_threshold = 0, coalesce_delay = 0;
+  mdadm_layout_t layout = MDADM_LAYOUT_LINEAR;
+  int chunk_blocks = MDADM_DEFAULT_CHUNK_BLOCKS;
+  int sched = -1, queue_depth = 64;
+  int sign_threads = sysconf(_SC_NPROCESSORS_ONLN);
   char *workload = NULL;
 
+  /* before any thread starts, so they all leave the signal to the thread that prints */
+  if (stats_dump_on_signal(SIGUSR1) == -1)
+    warnx("Cannot dump the stats on SIGUSR1.");
+  if (sign_threads < 1)
+    sign_threads = 1;
+  if (sign_threads > VERIFY_MAX_THREADS)
+    sign_threads = VERIFY_MAX_THREADS;
+
   while ((ch = getopt(argc, argv, TESTER_ARGUMENTS)) != -1) {
     switch (ch) {
       case 'h':
@@ -44,6 +82,86 @@ int main(int argc, char *argv[])
       case 'w':
         workload = optarg;
         break;
+      case 'p':
+        if (cache_policy_from_name(optarg) == -1) {
+          fprintf(stderr, "Unknown cache policy (%s), aborting.\n", optarg);
+          return -1;
+        }
+        policy = cache_policy_from_name(optarg);
+        break;
+      case 'b':
+        write_back = 1;
+        break;
+      case 't':
+        if (jbod_transport_from_name(optarg) == -1) {
+          fprintf(stderr, "Unknown transport (%s), aborting.\n", optarg);
+          return -1;
+        }
+        jbod_client_set_transport(jbod_transport_from_name(optarg));
+        break;
+      case 'c':
+        if (jbod_client_set_connections(atoi(optarg)) == -1) {
+          fprintf(stderr, "Number of connections must be between 1 and %d, aborting.\n", JBOD_MAX_CONNECTIONS);
+          return -1;
+        }
+        break;
+      case 'r':
+        readahead = atoi(optarg);
+        if (readahead < 0 || readahead > JBOD_MAX_BATCH) {
+          fprintf(stderr, "Readahead must be between 0 and %d blocks, aborting.\n", JBOD_MAX_BATCH);
+          return -1;
+        }
+        break;
+      case 'm':
+        coalesce_threshold = atoi(optarg);
+        if (coalesce_threshold < 0 || coalesce_threshold > JBOD_MAX_BATCH) {
+          fprintf(stderr, "Coalescing threshold must be between 0 and %d blocks, aborting.\n", JBOD_MAX_BATCH);
+          return -1;
+        }
+        break;
+      case 'd':
+        coalesce_delay = atoi(optarg);
+        break;
+      case 'l':
+        if (mdadm_layout_from_name(optarg) == -1) {
+          fprintf(stderr, "Unknown layout (%s), aborting.\n", optarg);
+          return -1;
+        }
+        layout = mdadm_layout_from_name(optarg);
+        break;
+      case 'k':
+        chunk_blocks = atoi(optarg);
+        break;
+      case 'q':
+        if (mdadm_sched_from_name(optarg) == -1) {
+          fprintf(stderr, "Unknown scheduler (%s), aborting.\n", optarg);
+          return -1;
+        }
+        sched = mdadm_sched_from_name(optarg);
+        break;
+      case 'n':
+        queue_depth = atoi(optarg);
+        break;
+      case 'e':
+        if (jbod_backend_from_name(optarg) == -1) {
+          fprintf(stderr, "Unknown backend (%s), aborting.\n", optarg);
+          return -1;
+        }
+        jbod_client_set_backend(jbod_backend_from_name(optarg));
+        break;
+      case 'i':
+        jbod_client_set_image(optarg);
+        break;
+      case 'j':
+        sign_threads = atoi(optarg);
+        if (sign_threads < 0 || sign_threads > VERIFY_MAX_THREADS) {
+          fprintf(stderr, "Signing threads must be between 0 and %d, aborting.\n", VERIFY_MAX_THREADS);
+          return -1;
+        }
+        break;
+      case 'x':
+        mdadm_set_integrity(1, optarg);
+        break;
       default:
         fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
         return -1;
@@ -55,10 +173,16 @@ int main(int argc, char *argv[])
     return -1;
   }
 
+  if (mdadm_set_layout(layout, chunk_blocks) != 1) {
+    fprintf(stderr, "Chunk size must be a power of two of at most %d blocks, aborting.\n", JBOD_NUM_BLOCKS_PER_DISK);
+    return -1;
+  }
+
   if (!jbod_connect(JBOD_SERVER, JBOD_PORT))
     return -1;
   
-  run_workload(workload, cache_size);
+  run_workload(workload, cache_size, policy, write_back, readahead, coalesce_threshold, coalesce_delay, sched,
+               queue_depth, sign_threads);
   jbod_disconnect();
 
   return 0;
@@ -80,9 +204,12 @@ static uint32_t encode_op(jbod_cmd_t cmd, int disk_num, int block_num) {
   return op;
 }
 
-int run_workload(char *workload, int cache_size) {
+int run_workload(char *workload, int cache_size, cache_policy_t policy, int write_back, int readahead,
+                 int coalesce_threshold, int coalesce_delay, int sched, int queue_depth, int sign_threads) {
+  static verify_tree_t tree;
+  static char sigs[VERIFY_NUM_BLOCKS][VERIFY_SIG_LINE_LEN];
   char line[256], cmd[32];
-  uint8_t buf[MAX_IO_SIZE];
+  uint8_t buf[MAX_IO_SIZE], read_buf[MAX_IO_SIZE];
   uint32_t addr, len, ch;
   int rc;
 
@@ -93,10 +220,16 @@ int run_workload(char *workload, int cache_size) {
     err(1, "Cannot open workload file %s", workload);
 
   if (cache_size) {
-    rc = cache_create(cache_size);
+    rc = cache_create_with_policy(cache_size, policy);
     if (rc != 1)
       errx(1, "Failed to create cache.");
   }
+  mdadm_set_write_back(write_back);
+  mdadm_set_readahead(readahead);
+  if (mdadm_set_write_coalescing(coalesce_threshold, coalesce_delay) != 1)
+    errx(1, "Failed to set up write coalescing.");
+  if (sched != -1 && mdadm_queue_start(sched, queue_depth) != 1)
+    errx(1, "Queue depth must be between 8 and %d blocks.", MDADM_QUEUE_MAX_DEPTH);
 
   int line_num = 0;
   while (fgets(line, 256, f)) {
@@ -111,20 +244,35 @@ int run_workload(char *workload, int cache_size) {
     } else if (equals(line, "WRITE_PERMIT_REVOKE")) {
       rc = mdadm_revoke_write_permission();
     } else if (equals(line, "SIGNALL")) {
-      for (int i = 0; i < JBOD_NUM_DISKS; ++i)
-        for (int j = 0; j < JBOD_NUM_BLOCKS_PER_DISK; ++j) {
-          uint8_t b[JBOD_BLOCK_SIZE];
-          jbod_client_operation(encode_op(JBOD_SIGN_BLOCK, i, j), b);
-          fprintf(stdout, "%s", b);
-        }
+      /* the signatures are of what is on the disks, so they need every dirty block first */
+      mdadm_flush();
+      if (sign_threads == 0) {
+        for (int i = 0; i < JBOD_NUM_DISKS; ++i)
+          for (int j = 0; j < JBOD_NUM_BLOCKS_PER_DISK; ++j) {
+            uint8_t b[JBOD_BLOCK_SIZE];
+            jbod_client_operation(encode_op(JBOD_SIGN_BLOCK, i, j), b);
+            fprintf(stdout, "%s", b);
+          }
+      } else {
+        if (verify_scan(&tree, sigs, sign_threads) != 1)
+          errx(1, "Failed to read the disks to sign them.");
+        for (int b = 0; b < VERIFY_NUM_BLOCKS; ++b)
+          fputs(sigs[b], stdout);
+        fprintf(stderr, "Array digest: ");
+        for (int i = 0; i < VERIFY_DIGEST_LEN; ++i)
+          fprintf(stderr, "%02x", verify_root(&tree)[i]);
+        fprintf(stderr, "\n");
+      }
     } else {
       if (sscanf(line, "%7s %7u %4u %3u", cmd, &addr, &len, &ch) != 4)
         errx(1, "Failed to parse command: [%s\n], aborting.", line);
       if (equals(cmd, "READ")) {
-        rc = mdadm_read(addr, len, buf);
+        /* a queued read lands whenever it is dispatched, which may be in the middle of a later write, so it cannot
+         * share that write's buffer. nothing looks at what it read */
+        rc = mdadm_queue_read(addr, len, read_buf);
       } else if (equals(cmd, "WRITE")) {
         memset(buf, ch, len);
-        rc = mdadm_write(addr, len, buf);
+        rc = mdadm_queue_write(addr, len, buf);
       } else {
         errx(1, "Unknown command [%s] on line %d, aborting.", line, line_num);
       }
@@ -132,10 +280,16 @@ int run_workload(char *workload, int cache_size) {
   }
   fclose(f);
 
+  if (mdadm_queue_stop() != 1)
+    errx(1, "Failed to drain the queue.");
   if (cache_size)
     cache_destroy();
 
   cache_print_hit_rate();
+  mdadm_print_write_stats();
+  mdadm_print_integrity_stats();
+  jbod_client_print_seek_stats();
+  stats_print(stderr);
 
   return 0;
 }
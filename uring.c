@@ -0,0 +1,107 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "stats.h"
+#include "uring.h"
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p) {
+  return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+  stats_count(STATS_URING_ENTERS);
+  return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+int uring_init(uring_t *r, unsigned entries) {
+  struct io_uring_params p;
+
+  memset(r, 0, sizeof(*r));
+  memset(&p, 0, sizeof(p));
+  //IORING_SETUP_DEFER_TASKRUN is deliberately left off: it defers issuing each linked request to the next
+  //io_uring_enter, so a chain of sends would trickle out one per call
+  r->fd = sys_io_uring_setup(entries, &p);
+  if (r->fd == -1)
+    return -1;
+
+  r->sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  r->cq_ring_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+  r->sq_ring = mmap(NULL, r->sq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+                    IORING_OFF_SQ_RING);
+  r->cq_ring = mmap(NULL, r->cq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+                    IORING_OFF_CQ_RING);
+  r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+  if (r->sq_ring == MAP_FAILED || r->cq_ring == MAP_FAILED || r->sqes == MAP_FAILED) {
+    uring_exit(r);
+    return -1;
+  }
+
+  r->sq_head = (unsigned *)((char *)r->sq_ring + p.sq_off.head);
+  r->sq_tail = (unsigned *)((char *)r->sq_ring + p.sq_off.tail);
+  r->sq_mask = (unsigned *)((char *)r->sq_ring + p.sq_off.ring_mask);
+  r->sq_array = (unsigned *)((char *)r->sq_ring + p.sq_off.array);
+  r->cq_head = (unsigned *)((char *)r->cq_ring + p.cq_off.head);
+  r->cq_tail = (unsigned *)((char *)r->cq_ring + p.cq_off.tail);
+  r->cq_mask = (unsigned *)((char *)r->cq_ring + p.cq_off.ring_mask);
+  r->cqes = (struct io_uring_cqe *)((char *)r->cq_ring + p.cq_off.cqes);
+  return 0;
+}
+
+void uring_exit(uring_t *r) {
+  if (r->sq_ring != NULL && r->sq_ring != MAP_FAILED)
+    munmap(r->sq_ring, r->sq_ring_len);
+  if (r->cq_ring != NULL && r->cq_ring != MAP_FAILED)
+    munmap(r->cq_ring, r->cq_ring_len);
+  if (r->sqes != NULL && r->sqes != MAP_FAILED)
+    munmap(r->sqes, r->sqes_len);
+  if (r->fd != -1)
+    close(r->fd);
+  memset(r, 0, sizeof(*r));
+  r->fd = -1;
+}
+
+struct io_uring_sqe *uring_get_sqe(uring_t *r) {
+  unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+  unsigned tail = *r->sq_tail + r->pending;
+
+  if (tail - head > *r->sq_mask)
+    return NULL;
+  //entries are used in order, so the index array is the identity
+  unsigned i = tail & *r->sq_mask;
+  r->sq_array[i] = i;
+  r->pending++;
+  memset(&r->sqes[i], 0, sizeof(r->sqes[i]));
+  return &r->sqes[i];
+}
+
+int uring_submit(uring_t *r, unsigned wait_nr) {
+  unsigned to_submit = r->pending;
+
+  //publish the new entries before the kernel can look at the tail
+  __atomic_store_n(r->sq_tail, *r->sq_tail + r->pending, __ATOMIC_RELEASE);
+  r->pending = 0;
+  if (to_submit == 0 && wait_nr == 0)
+    return 0;
+  //the kernel only takes entries that are actually queued, so retrying after a signal cannot submit one twice
+  while (sys_io_uring_enter(r->fd, to_submit, wait_nr, IORING_ENTER_GETEVENTS) == -1) {
+    if (errno != EINTR)
+      return -1;
+  }
+  return 0;
+}
+
+struct io_uring_cqe *uring_peek_cqe(uring_t *r) {
+  unsigned head = *r->cq_head;
+
+  if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+    return NULL;
+  return &r->cqes[head & *r->cq_mask];
+}
+
+void uring_cqe_seen(uring_t *r) {
+  __atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+}
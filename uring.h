@@ -0,0 +1,46 @@
+#ifndef URING_H_
+#define URING_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+/* a minimal io_uring, set up and driven with the raw system calls so the
+ * client does not need liburing. only one thread may use a ring at a time */
+typedef struct {
+  int fd;
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  /* entries filled in by uring_get_sqe but not yet handed to the kernel */
+  unsigned pending;
+  void *sq_ring, *cq_ring;
+  size_t sq_ring_len, cq_ring_len, sqes_len;
+} uring_t;
+
+/* Sets up a ring with room for |entries| submissions; returns 0 on success
+ * and -1 if the kernel does not support io_uring (or refuses to let us use
+ * it). */
+int uring_init(uring_t *r, unsigned entries);
+
+/* Tears down a ring set up by uring_init. */
+void uring_exit(uring_t *r);
+
+/* Returns a zeroed submission queue entry to fill in, or NULL if the queue is
+ * full of entries that have not been submitted yet. */
+struct io_uring_sqe *uring_get_sqe(uring_t *r);
+
+/* Hands every pending entry to the kernel and, if |wait_nr| is not 0, waits
+ * until at least that many completions are available; returns 0 on success
+ * and -1 on failure. */
+int uring_submit(uring_t *r, unsigned wait_nr);
+
+/* Returns the oldest completion that has not been consumed, or NULL if there
+ * is none. */
+struct io_uring_cqe *uring_peek_cqe(uring_t *r);
+
+/* Consumes the completion returned by uring_peek_cqe. */
+void uring_cqe_seen(uring_t *r);
+
+#endif
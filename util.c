@@ -4,11 +4,18 @@
 #include <fcntl.h>
 #include <stdint.h>
 #include <assert.h>
+#include <pthread.h>
+#include <string.h>
 #include <openssl/sha.h>
 #include <openssl/rand.h>
 
 #include "util.h"
 
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+#endif
+
 static int debug_log_enabled = 0;
 static int debug_log_fd = 2;  /* by default write log to stderr */
 
@@ -34,15 +41,31 @@ void debug_log(const char *fmt, ...) {
 }
 
 const char *sha1_sig(uint8_t *buf, uint32_t size) {
-  static char sig[80];
-  uint8_t obuf[20];
+  static char sig[SHA1_SIG_LEN];
+
+  return sha1_sig_r(buf, size, sig);
+}
+
+const char *sha1_sig_r(const uint8_t *buf, uint32_t size, char *sig) {
+  uint8_t obuf[SHA_DIGEST_LENGTH];
 
   SHA1(buf, size, obuf);
+  sha1_sig_format(obuf, sig);
+  return sig;
+}
+
+void sha1_sig_format(const uint8_t *digest, char *sig) {
+  static const char hex[] = "0123456789abcdef";
+
   for (int i = 0; i < 15; ++i) {
-    char *p = (char *)sig + i * 5;
-    sprintf(p, "0x%02x ", obuf[i]);
+    char *p = sig + i * 5;
+    p[0] = '0';
+    p[1] = 'x';
+    p[2] = hex[digest[i] >> 4];
+    p[3] = hex[digest[i] & 0xf];
+    p[4] = ' ';
   }
-  return sig;
+  sig[75] = '\0';
 }
 
 uint32_t get_rand(uint32_t min, uint32_t max) {
@@ -55,3 +78,102 @@ uint32_t get_rand(uint32_t min, uint32_t max) {
     v = max;
   return v;
 }
+
+/* the reflected Castagnoli polynomial */
+#define CRC32C_POLY 0x82f63b78
+
+static uint32_t crc32c_table[8][256];
+static uint32_t (*crc32c_impl)(const uint8_t *buf, size_t len);
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+/* software CRC32C, eight bytes per step: crc32c_table[k][b] is the CRC of
+ * byte b followed by k zero bytes */
+static uint32_t crc32c_sw(const uint8_t *buf, size_t len) {
+  uint32_t crc = 0xffffffff;
+
+  for (; len >= 8; len -= 8, buf += 8) {
+    uint32_t lo, hi;
+    memcpy(&lo, buf, 4);
+    memcpy(&hi, buf + 4, 4);
+    lo ^= crc;
+    crc = crc32c_table[7][lo & 0xff] ^ crc32c_table[6][(lo >> 8) & 0xff] ^ crc32c_table[5][(lo >> 16) & 0xff] ^
+          crc32c_table[4][lo >> 24] ^ crc32c_table[3][hi & 0xff] ^ crc32c_table[2][(hi >> 8) & 0xff] ^
+          crc32c_table[1][(hi >> 16) & 0xff] ^ crc32c_table[0][hi >> 24];
+  }
+  for (; len > 0; --len)
+    crc = crc32c_table[0][(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+  return ~crc;
+}
+
+#if defined(__x86_64__)
+/* the hardware path runs three streams of CRC32C_STRIDE bytes side by side,
+ * since each crc32 instruction waits on the one before it, and then shifts the
+ * first two streams' CRCs past the bytes that followed them and folds them
+ * in. crc32c_shift[k] is x^(8 * (k + 1) * CRC32C_STRIDE - 33) mod P, which a
+ * carry-less multiply and one crc32 turn into that shift */
+#define CRC32C_STRIDE 80
+
+static uint32_t crc32c_shift[2];
+
+__attribute__((target("sse4.2,pclmul"))) static uint64_t crc32c_shift_by(uint32_t crc, uint32_t k) {
+  __m128i prod = _mm_clmulepi64_si128(_mm_cvtsi32_si128(crc), _mm_cvtsi32_si128(k), 0);
+  return _mm_crc32_u64(0, _mm_cvtsi128_si64(prod));
+}
+
+__attribute__((target("sse4.2,pclmul"))) static uint32_t crc32c_sse42(const uint8_t *buf, size_t len) {
+  uint64_t crc = 0xffffffff;
+
+  for (; len >= 3 * CRC32C_STRIDE; len -= 3 * CRC32C_STRIDE, buf += 3 * CRC32C_STRIDE) {
+    uint64_t crc1 = 0, crc2 = 0;
+    for (int i = 0; i < CRC32C_STRIDE; i += 8) {
+      uint64_t v0, v1, v2;
+      memcpy(&v0, buf + i, 8);
+      memcpy(&v1, buf + CRC32C_STRIDE + i, 8);
+      memcpy(&v2, buf + 2 * CRC32C_STRIDE + i, 8);
+      crc = _mm_crc32_u64(crc, v0);
+      crc1 = _mm_crc32_u64(crc1, v1);
+      crc2 = _mm_crc32_u64(crc2, v2);
+    }
+    crc = crc32c_shift_by(crc, crc32c_shift[1]) ^ crc32c_shift_by(crc1, crc32c_shift[0]) ^ crc2;
+  }
+  for (; len >= 8; len -= 8, buf += 8) {
+    uint64_t v;
+    memcpy(&v, buf, 8);
+    crc = _mm_crc32_u64(crc, v);
+  }
+  for (; len > 0; --len)
+    crc = _mm_crc32_u8((uint32_t)crc, *buf++);
+  return ~(uint32_t)crc;
+}
+#endif
+
+static void crc32c_init(void) {
+  for (int b = 0; b < 256; ++b) {
+    uint32_t crc = b;
+    for (int k = 0; k < 8; ++k)
+      crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+    crc32c_table[0][b] = crc;
+  }
+  for (int b = 0; b < 256; ++b)
+    for (int k = 1; k < 8; ++k)
+      crc32c_table[k][b] = crc32c_table[0][crc32c_table[k - 1][b] & 0xff] ^ (crc32c_table[k - 1][b] >> 8);
+
+  crc32c_impl = crc32c_sw;
+#if defined(__x86_64__)
+  /* x^0 is the top bit of a reflected CRC, and multiplying by x shifts it down */
+  uint32_t k = 0x80000000;
+  for (int n = 1; n <= 8 * 2 * CRC32C_STRIDE - 33; ++n) {
+    k = k & 1 ? (k >> 1) ^ CRC32C_POLY : k >> 1;
+    if (n == 8 * CRC32C_STRIDE - 33)
+      crc32c_shift[0] = k;
+  }
+  crc32c_shift[1] = k;
+  if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("pclmul"))
+    crc32c_impl = crc32c_sse42;
+#endif
+}
+
+uint32_t crc32c(const uint8_t *buf, size_t len) {
+  pthread_once(&crc32c_once, crc32c_init);
+  return crc32c_impl(buf, len);
+}
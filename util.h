@@ -1,13 +1,26 @@
 #ifndef UTIL_H_
 #define UTIL_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
 void enable_debug_log(void);
 void set_debug_logfile(const char *filename);
 void debug_log(const char *fmt, ...);
 
+/* sha1_sig returns the first 15 bytes of the SHA1 of buf as "0x.. " hex,
+ * in a static buffer. sha1_sig_r writes them into sig, which must hold
+ * SHA1_SIG_LEN bytes, so several threads can sign at once, and
+ * sha1_sig_format does the same for a digest that is already computed */
+#define SHA1_SIG_LEN 76
 const char *sha1_sig(uint8_t *buf, uint32_t size);
+const char *sha1_sig_r(const uint8_t *buf, uint32_t size, char *sig);
+void sha1_sig_format(const uint8_t *digest, char *sig);
 uint32_t get_rand(uint32_t min, uint32_t max);
 
+/* returns the CRC32C (Castagnoli) of buf, with the SSE4.2 crc32 instruction
+ * (three streams at a time, joined with PCLMULQDQ) when the CPU has them
+ * and slicing-by-8 tables otherwise */
+uint32_t crc32c(const uint8_t *buf, size_t len);
+
 #endif
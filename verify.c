@@ -0,0 +1,154 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/sha.h>
+
+#include "net.h"
+#include "util.h"
+#include "verify.h"
+
+/* the first leaf, and the level of the tree whose nodes each cover a disk */
+#define FIRST_LEAF (VERIFY_NUM_BLOCKS - 1)
+#define DISK_LEVEL 4
+#define NUM_LEVELS 12
+
+/* a scan in progress. the calling thread reads the disks in order and bumps
+ * disks_read after each; the hashing threads each take the next disk to hash
+ * and wait until it has been read. failed stops them early */
+struct scan {
+  verify_tree_t *tree;
+  char (*sigs)[VERIFY_SIG_LINE_LEN];
+  uint8_t *data;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int disks_read;
+  int next_disk;
+  bool failed;
+};
+
+/* sets node i to the hash of its children, which sit next to each other */
+static void hash_node(verify_tree_t *tree, int i) {
+  SHA1(tree->nodes[2 * i + 1], 2 * VERIFY_DIGEST_LEN, tree->nodes[i]);
+}
+
+/* hashes a disk's blocks into their leaves (and signature lines), then the
+ * subtree above them up to the disk's node */
+static void hash_disk(struct scan *s, int disk) {
+  int first = disk * JBOD_NUM_BLOCKS_PER_DISK;
+  char sig[SHA1_SIG_LEN];
+
+  for (int b = first; b < first + JBOD_NUM_BLOCKS_PER_DISK; ++b) {
+    uint8_t *leaf = s->tree->nodes[FIRST_LEAF + b];
+    SHA1(&s->data[b * JBOD_BLOCK_SIZE], JBOD_BLOCK_SIZE, leaf);
+    if (s->sigs != NULL) {
+      sha1_sig_format(leaf, sig);
+      snprintf(s->sigs[b], VERIFY_SIG_LINE_LEN, "SIG(disk,block) %2d %3d : %s\n", disk, b % JBOD_NUM_BLOCKS_PER_DISK,
+               sig);
+    }
+  }
+  //the disk's node is node (1 << DISK_LEVEL) - 1 + disk, and its descendants on each level below are contiguous
+  int root = (1 << DISK_LEVEL) - 1 + disk;
+  for (int level = NUM_LEVELS - 1; level >= DISK_LEVEL; --level) {
+    int count = 1 << (level - DISK_LEVEL);
+    int start = (root + 1) * count - 1;
+    for (int i = start; i < start + count; ++i)
+      hash_node(s->tree, i);
+  }
+}
+
+static void *hash_disks(void *arg) {
+  struct scan *s = arg;
+
+  for (;;) {
+    pthread_mutex_lock(&s->lock);
+    int disk = s->next_disk++;
+    while (disk < JBOD_NUM_DISKS && disk >= s->disks_read && !s->failed)
+      pthread_cond_wait(&s->cond, &s->lock);
+    bool stop = disk >= JBOD_NUM_DISKS || s->failed;
+    pthread_mutex_unlock(&s->lock);
+    if (stop)
+      return NULL;
+    hash_disk(s, disk);
+  }
+}
+
+/* reads every block of disk into its place in s->data */
+static int read_disk(struct scan *s, int disk) {
+  jbod_block_addr_t addrs[JBOD_MAX_BATCH];
+  uint8_t *buf = &s->data[disk * JBOD_DISK_SIZE];
+
+  for (int first = 0; first < JBOD_NUM_BLOCKS_PER_DISK; first += JBOD_MAX_BATCH) {
+    for (int i = 0; i < JBOD_MAX_BATCH; ++i)
+      addrs[i] = (jbod_block_addr_t){disk, first + i};
+    if (jbod_client_read_blocks(addrs, JBOD_MAX_BATCH, &buf[first * JBOD_BLOCK_SIZE]) == -1)
+      return -1;
+  }
+  return 1;
+}
+
+int verify_scan(verify_tree_t *tree, char (*sigs)[VERIFY_SIG_LINE_LEN], int threads) {
+  pthread_t workers[VERIFY_MAX_THREADS];
+  int started = 0, rc = 1;
+
+  if (tree == NULL || threads < 1 || threads > VERIFY_MAX_THREADS)
+    return -1;
+  struct scan s = {.tree = tree, .sigs = sigs, .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER};
+  s.data = malloc(VERIFY_NUM_BLOCKS * JBOD_BLOCK_SIZE);
+  if (s.data == NULL)
+    return -1;
+
+  for (; started < threads; ++started)
+    if (pthread_create(&workers[started], NULL, hash_disks, &s) != 0)
+      break;
+  for (int disk = 0; disk < JBOD_NUM_DISKS; ++disk) {
+    int read = read_disk(&s, disk);
+    pthread_mutex_lock(&s.lock);
+    if (read == -1)
+      s.failed = true;
+    else
+      s.disks_read++;
+    pthread_cond_broadcast(&s.cond);
+    pthread_mutex_unlock(&s.lock);
+    if (read == -1)
+      break;
+  }
+  //with no thread to hash on, the disks are hashed here
+  if (started == 0)
+    hash_disks(&s);
+  for (int i = 0; i < started; ++i)
+    pthread_join(workers[i], NULL);
+  if (s.failed)
+    rc = -1;
+  else
+    for (int i = (1 << DISK_LEVEL) - 2; i >= 0; --i)
+      hash_node(tree, i);
+
+  free(s.data);
+  pthread_mutex_destroy(&s.lock);
+  pthread_cond_destroy(&s.cond);
+  return rc;
+}
+
+const uint8_t *verify_root(const verify_tree_t *tree) {
+  return tree->nodes[0];
+}
+
+/* adds the differing blocks under node i to blocks, found of them so far;
+ * returns how many have been found with them */
+static int diff_node(const verify_tree_t *a, const verify_tree_t *b, int i, int *blocks, int max, int found) {
+  if (memcmp(a->nodes[i], b->nodes[i], VERIFY_DIGEST_LEN) == 0)
+    return found;
+  if (i >= FIRST_LEAF) {
+    if (found < max)
+      blocks[found] = i - FIRST_LEAF;
+    return found + 1;
+  }
+  found = diff_node(a, b, 2 * i + 1, blocks, max, found);
+  return diff_node(a, b, 2 * i + 2, blocks, max, found);
+}
+
+int verify_diff(const verify_tree_t *a, const verify_tree_t *b, int *blocks, int max) {
+  return diff_node(a, b, 0, blocks, max, 0);
+}
@@ -0,0 +1,45 @@
+#ifndef VERIFY_H_
+#define VERIFY_H_
+
+#include <stdint.h>
+
+#include "jbod.h"
+
+/* every block of the JBOD, numbered disk * JBOD_NUM_BLOCKS_PER_DISK + block */
+#define VERIFY_NUM_BLOCKS (JBOD_NUM_DISKS * JBOD_NUM_BLOCKS_PER_DISK)
+
+#define VERIFY_DIGEST_LEN 20
+
+/* the most threads verify_scan hashes on: one per disk */
+#define VERIFY_MAX_THREADS JBOD_NUM_DISKS
+
+/* room for one JBOD_SIGN_BLOCK line, "SIG(disk,block) %2d %3d : <sig>\n" */
+#define VERIFY_SIG_LINE_LEN 128
+
+/* a Merkle tree over the SHA1 digests of the blocks, kept as a heap: node 0
+ * is the root (the array digest), node i has children 2i+1 and 2i+2, and
+ * block b is leaf VERIFY_NUM_BLOCKS - 1 + b. every other node is the SHA1 of
+ * its two children, so two trees that differ in one block differ only along
+ * the path from its leaf to the root */
+typedef struct {
+  uint8_t nodes[2 * VERIFY_NUM_BLOCKS - 1][VERIFY_DIGEST_LEN];
+} verify_tree_t;
+
+/* Returns 1 on success and -1 on failure. Reads every block, one batch of
+ * JBOD_MAX_BATCH at a time, through the calling thread's client, which must
+ * have the JBOD mounted, and builds their tree in |tree|. Each disk is hashed
+ * on one of |threads| threads (1 to VERIFY_MAX_THREADS) as soon as it has
+ * been read, while the next disks are still being read. If |sigs| is not
+ * NULL, sigs[b] gets the line JBOD_SIGN_BLOCK returns for block b. */
+int verify_scan(verify_tree_t *tree, char (*sigs)[VERIFY_SIG_LINE_LEN], int threads);
+
+/* Returns the array digest, VERIFY_DIGEST_LEN bytes at the root of |tree|. */
+const uint8_t *verify_root(const verify_tree_t *tree);
+
+/* Finds the blocks whose digests differ between |a| and |b|, only looking
+ * into subtrees whose digests differ, so a single changed block is found
+ * with O(log n) comparisons. Writes the first |max| of them, in ascending
+ * order, into |blocks| and returns how many differ in all. */
+int verify_diff(const verify_tree_t *a, const verify_tree_t *b, int *blocks, int max);
+
+#endif